@@ -0,0 +1,603 @@
+#include "apu.h"
+
+#include "debug.h"
+
+#include <math.h>
+#include <string.h>
+
+#define CLOCK_HZ 4194304
+
+// Nothing is synthesized per tick. Channels are only run forward when a
+// register is touched or this many cycles have gone by, at which point the
+// samples are handed to the sinks.
+#define FLUSH_CYCLES 16384
+
+// 512 Hz frame sequencer driving length, sweep and envelope
+#define SEQUENCER_CYCLES 8192
+
+// Level changes are written as band-limited steps, a windowed sinc spread
+// over KERNEL_TAPS samples at one of KERNEL_PHASES sub-sample offsets, and
+// integrated into samples on flush
+#define KERNEL_TAPS 16
+#define KERNEL_PHASES 32
+#define KERNEL_UNIT (1 << 15)
+
+// Enough for FLUSH_CYCLES plus the longest halted stretch at up to 192 kHz
+#define BUFFER_SAMPLES 4096
+
+// Four channels of 15 at volume 8 fill the int16 range after this shift
+#define OUTPUT_SHIFT 9
+
+#define MAX_SINKS 4
+
+enum { SQUARE1, SQUARE2, WAVE, NOISE, CHANNELS };
+
+static ApuChannel channels[CHANNELS];
+
+// FF10-FF2F as last written, for reads
+static uint8_t regs[0x20];
+
+// FF30-FF3F - Wave Pattern RAM
+static uint8_t waveRam[0x10];
+
+// FF24 - Channel control / ON-OFF / Volume
+static uint8_t leftVolume = 0;
+static uint8_t rightVolume = 0;
+
+// FF25 - Selection of Sound output terminal
+static uint8_t panning = 0;
+
+// FF26 - Sound on/off
+static uint8_t power = 0;
+
+static const uint8_t readMasks[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,
+    0x00, 0x00, 0x70, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+// Waveforms with step 0 in the top bit
+static const uint8_t dutyWaves[] = {
+    0x01, 0x81, 0x87, 0x7E
+};
+
+static const uint8_t noiseDivisors[] = {
+    8, 16, 32, 48, 64, 80, 96, 112
+};
+
+// Shift applied to wave samples for each NR32 output level
+static const uint8_t waveShifts[] = {
+    4, 0, 1, 2
+};
+
+// Cycles since the last flush, and how far the channels have been run
+static uint32_t clock = 0;
+static uint32_t synthTime = 0;
+static uint32_t nextSequencer = SEQUENCER_CYCLES;
+static uint8_t sequencerStep = 0;
+
+static int16_t kernel[KERNEL_PHASES][KERNEL_TAPS];
+static int32_t deltas[2][BUFFER_SAMPLES + KERNEL_TAPS];
+static int32_t integrator[2];
+static int32_t dcLevel[2];
+static int16_t samples[BUFFER_SAMPLES * 2];
+
+// Output samples per cycle, and the output position of cycle 0, as 32.32
+static uint64_t samplesPerClock = 0;
+static uint64_t sampleFraction = 0;
+static uint32_t pendingRate = 0;
+
+static ApuSink sinks[MAX_SINKS];
+static uint8_t sinkCount = 0;
+
+// While speculating the channels run but nothing is heard
+static uint8_t speculating = 0;
+static uint32_t speculationStart = 0;
+
+static void buildKernel(void)
+{
+    for (uint8_t phase = 0; phase < KERNEL_PHASES; phase++)
+    {
+        double taps[KERNEL_TAPS];
+        double sum = 0;
+        for (uint8_t i = 0; i < KERNEL_TAPS; i++)
+        {
+            // cut off a little below nyquist so the window's skirt stays out
+            double t = i - (KERNEL_TAPS / 2 - 1) - (double)phase / KERNEL_PHASES;
+            double x = M_PI * 0.9 * t;
+            double sinc = x == 0 ? 1 : sin(x) / x;
+            double w = 2 * M_PI * t / KERNEL_TAPS;
+            double window = 0.42 + 0.5 * cos(w) + 0.08 * cos(2 * w);
+            taps[i] = sinc * (fabs(t) < KERNEL_TAPS / 2 ? window : 0);
+            sum += taps[i];
+        }
+        // every phase has to add up to exactly one step
+        int32_t total = 0;
+        for (uint8_t i = 0; i < KERNEL_TAPS; i++)
+        {
+            kernel[phase][i] = (int16_t)lround(taps[i] / sum * KERNEL_UNIT);
+            total += kernel[phase][i];
+        }
+        kernel[phase][KERNEL_TAPS / 2 - 1] += KERNEL_UNIT - total;
+    }
+}
+
+static void addDelta(uint8_t side, uint32_t time, int32_t delta)
+{
+    uint64_t position = time * samplesPerClock + sampleFraction;
+    const int16_t *taps = kernel[(position >> 27) & (KERNEL_PHASES - 1)];
+    int32_t *out = &deltas[side][position >> 32];
+    for (uint8_t i = 0; i < KERNEL_TAPS; i++)
+        out[i] += delta * taps[i];
+}
+
+static uint32_t period(uint8_t c)
+{
+    ApuChannel *ch = &channels[c];
+    switch (c)
+    {
+        case SQUARE1:
+        case SQUARE2:
+            return (2048 - ch->frequency) * 4;
+        case WAVE:
+            return (2048 - ch->frequency) * 2;
+        default:
+            return (uint32_t)noiseDivisors[ch->divisorCode] << ch->clockShift;
+    }
+}
+
+static uint8_t output(uint8_t c)
+{
+    ApuChannel *ch = &channels[c];
+    if (!ch->enabled || !ch->dacEnabled)
+        return 0;
+    switch (c)
+    {
+        case SQUARE1:
+        case SQUARE2:
+            return (dutyWaves[ch->duty] >> (7 - ch->position)) & 1 ? ch->volume : 0;
+        case WAVE:
+        {
+            uint8_t sample = waveRam[ch->position / 2];
+            sample = ch->position & 1 ? sample & 0xF : sample >> 4;
+            return sample >> waveShifts[ch->volumeShift];
+        }
+        default:
+            return ch->lfsr & 1 ? 0 : ch->volume;
+    }
+}
+
+static void mix(uint8_t c, uint32_t time)
+{
+    if (speculating)
+        return;
+    ApuChannel *ch = &channels[c];
+    int32_t level = output(c);
+    int32_t left = (panning >> (c + 4)) & 1 ? level * (leftVolume + 1) : 0;
+    int32_t right = (panning >> c) & 1 ? level * (rightVolume + 1) : 0;
+    if (left != ch->left)
+    {
+        addDelta(0, time, left - ch->left);
+        ch->left = left;
+    }
+    if (right != ch->right)
+    {
+        addDelta(1, time, right - ch->right);
+        ch->right = right;
+    }
+}
+
+static void clockWaveform(uint8_t c)
+{
+    ApuChannel *ch = &channels[c];
+    switch (c)
+    {
+        case SQUARE1:
+        case SQUARE2:
+            ch->position = (ch->position + 1) & 7;
+            break;
+        case WAVE:
+            ch->position = (ch->position + 1) & 31;
+            break;
+        default:
+        {
+            uint16_t bit = (ch->lfsr ^ (ch->lfsr >> 1)) & 1;
+            ch->lfsr = (ch->lfsr >> 1) | (bit << 14);
+            if (ch->widthMode)
+                ch->lfsr = (ch->lfsr & ~0x40) | (bit << 6);
+            break;
+        }
+    }
+}
+
+static void runChannel(uint8_t c, uint32_t end)
+{
+    ApuChannel *ch = &channels[c];
+    uint32_t p = period(c);
+    if (!ch->enabled || !ch->dacEnabled)
+    {
+        // silent, only the square and wave positions need to keep going
+        if (ch->next < end)
+        {
+            uint32_t steps = (end - ch->next + p - 1) / p;
+            ch->next += steps * p;
+            ch->position = (ch->position + steps) & (c == WAVE ? 31 : 7);
+        }
+        return;
+    }
+    while (ch->next < end)
+    {
+        clockWaveform(c);
+        mix(c, ch->next);
+        ch->next += p;
+    }
+}
+
+static uint16_t sweepFrequency(void)
+{
+    ApuChannel *ch = &channels[SQUARE1];
+    uint16_t delta = ch->shadowFrequency >> ch->sweepShift;
+    uint16_t frequency = ch->sweepNegate ? ch->shadowFrequency - delta : ch->shadowFrequency + delta;
+    if (frequency > 2047)
+        ch->enabled = 0;
+    return frequency;
+}
+
+static void clockSweep(void)
+{
+    ApuChannel *ch = &channels[SQUARE1];
+    if (ch->sweepTimer && --ch->sweepTimer)
+        return;
+    ch->sweepTimer = ch->sweepPeriod ? ch->sweepPeriod : 8;
+    if (!ch->sweepEnabled || !ch->sweepPeriod)
+        return;
+    uint16_t frequency = sweepFrequency();
+    if (frequency <= 2047 && ch->sweepShift)
+    {
+        ch->frequency = frequency;
+        ch->shadowFrequency = frequency;
+        sweepFrequency();
+    }
+}
+
+static void clockSequencer(uint32_t time)
+{
+    for (uint8_t c = 0; c < CHANNELS; c++)
+    {
+        ApuChannel *ch = &channels[c];
+        if (!(sequencerStep & 1) && ch->lengthEnable && ch->length && !--ch->length)
+            ch->enabled = 0;
+        if (sequencerStep == 7 && c != WAVE && ch->envelopePeriod)
+        {
+            if (ch->envelopeTimer)
+                ch->envelopeTimer--;
+            if (!ch->envelopeTimer)
+            {
+                ch->envelopeTimer = ch->envelopePeriod;
+                if (ch->envelopeIncrease && ch->volume < 15)
+                    ch->volume++;
+                else if (!ch->envelopeIncrease && ch->volume > 0)
+                    ch->volume--;
+            }
+        }
+    }
+    if (sequencerStep == 2 || sequencerStep == 6)
+        clockSweep();
+    sequencerStep = (sequencerStep + 1) & 7;
+    for (uint8_t c = 0; c < CHANNELS; c++)
+        mix(c, time);
+}
+
+static void run(uint32_t end)
+{
+    while (synthTime < end)
+    {
+        uint32_t until = end < nextSequencer ? end : nextSequencer;
+        for (uint8_t c = 0; c < CHANNELS; c++)
+            runChannel(c, until);
+        synthTime = until;
+        if (until == nextSequencer)
+        {
+            if (power)
+                clockSequencer(until);
+            nextSequencer += SEQUENCER_CYCLES;
+        }
+    }
+}
+
+static void flush(void)
+{
+    run(clock);
+    uint64_t end = clock * samplesPerClock + sampleFraction;
+    uint32_t count = end >> 32;
+    for (uint8_t side = 0; side < 2; side++)
+    {
+        int32_t *d = deltas[side];
+        for (uint32_t i = 0; i < count; i++)
+        {
+            integrator[side] += d[i];
+            int32_t level = integrator[side] >> OUTPUT_SHIFT;
+            // slow high pass, the channels only ever add so there's always
+            // an offset to take out
+            dcLevel[side] += ((level << 8) - dcLevel[side]) >> 10;
+            level -= dcLevel[side] >> 8;
+            if (level > INT16_MAX)
+                level = INT16_MAX;
+            else if (level < INT16_MIN)
+                level = INT16_MIN;
+            samples[i * 2 + side] = level;
+        }
+        memmove(d, d + count, KERNEL_TAPS * sizeof(*d));
+        memset(d + KERNEL_TAPS, 0, count * sizeof(*d));
+    }
+    sampleFraction = end & 0xFFFFFFFF;
+    for (uint8_t c = 0; c < CHANNELS; c++)
+        channels[c].next -= clock;
+    nextSequencer -= clock;
+    synthTime = 0;
+    clock = 0;
+
+    for (uint8_t i = 0; i < sinkCount; i++)
+        sinks[i](samples, count);
+    if (pendingRate)
+    {
+        samplesPerClock = ((uint64_t)pendingRate << 32) / CLOCK_HZ;
+        pendingRate = 0;
+    }
+}
+
+static void trigger(uint8_t c)
+{
+    ApuChannel *ch = &channels[c];
+    ch->enabled = ch->dacEnabled;
+    if (!ch->length)
+        ch->length = c == WAVE ? 256 : 64;
+    ch->next = clock + period(c);
+    ch->volume = ch->envelopeInitial;
+    ch->envelopeTimer = ch->envelopePeriod;
+    if (c == WAVE)
+        ch->position = 0;
+    if (c == NOISE)
+        ch->lfsr = 0x7FFF;
+    if (c == SQUARE1)
+    {
+        ch->shadowFrequency = ch->frequency;
+        ch->sweepTimer = ch->sweepPeriod ? ch->sweepPeriod : 8;
+        ch->sweepEnabled = ch->sweepPeriod || ch->sweepShift;
+        if (ch->sweepShift)
+            sweepFrequency();
+    }
+}
+
+void Apu_init(uint32_t sampleRate)
+{
+    buildKernel();
+    samplesPerClock = ((uint64_t)sampleRate << 32) / CLOCK_HZ;
+    for (uint8_t c = 0; c < CHANNELS; c++)
+        channels[c].next = period(c);
+#ifdef SKIP_BOOTROM
+    // what the boot rom leaves behind
+    Apu_wb(0xFF26, 0x80);
+    Apu_wb(0xFF11, 0x80);
+    Apu_wb(0xFF12, 0xF3);
+    Apu_wb(0xFF25, 0xF3);
+    Apu_wb(0xFF24, 0x77);
+#endif
+}
+
+// Takes effect at the next flush, so it's safe to call from a sink
+void Apu_setSampleRate(uint32_t sampleRate)
+{
+    pendingRate = sampleRate;
+}
+
+void Apu_addSink(ApuSink sink)
+{
+    if (sinkCount < MAX_SINKS)
+        sinks[sinkCount++] = sink;
+}
+
+void Apu_step(uint16_t ticks)
+{
+    clock += ticks;
+    if (clock >= FLUSH_CYCLES && !speculating)
+        flush();
+}
+
+// For running frames that are going to be thrown away. Output stops where it
+// is, and when speculation ends a state from before it has to be loaded,
+// which carries on from there.
+void Apu_setSpeculative(uint8_t speculative)
+{
+    run(clock);
+    if (speculative)
+        speculationStart = clock;
+    else
+        synthTime = clock = speculationStart;
+    speculating = speculative;
+}
+
+uint8_t Apu_rb(uint16_t addr)
+{
+    uint8_t res = 0xFF;
+    if (addr >= 0xFF30)
+        res = waveRam[addr - 0xFF30];
+    else if (addr == 0xFF26)
+    {
+        // length counters may have run out since anything last ran
+        run(clock);
+        res = 0x70 | (power << 7);
+        for (uint8_t c = 0; c < CHANNELS; c++)
+            res |= channels[c].enabled << c;
+    }
+    else
+        res = regs[addr - 0xFF10] | readMasks[addr - 0xFF10];
+    APU_PRINT(("apu read %04x, val %02x\n", addr, res));
+    return res;
+}
+
+void Apu_wb(uint16_t addr, uint8_t val)
+{
+    APU_PRINT(("apu write %04x, val %02x\n", addr, val));
+    if (addr >= 0xFF30)
+    {
+        run(clock);
+        waveRam[addr - 0xFF30] = val;
+        mix(WAVE, clock);
+        return;
+    }
+    if (!power && addr != 0xFF26)
+        return;
+
+    run(clock);
+    regs[addr - 0xFF10] = val;
+    uint8_t c = (addr - 0xFF10) / 5;
+    ApuChannel *ch = &channels[c < CHANNELS ? c : 0];
+    switch (addr)
+    {
+        case 0xFF10:
+            ch->sweepPeriod = (val >> 4) & 7;
+            ch->sweepNegate = (val >> 3) & 1;
+            ch->sweepShift = val & 7;
+            break;
+        case 0xFF11:
+        case 0xFF16:
+            ch->duty = val >> 6;
+            ch->length = 64 - (val & 0x3F);
+            break;
+        case 0xFF12:
+        case 0xFF17:
+        case 0xFF21:
+            ch->envelopeInitial = val >> 4;
+            ch->envelopeIncrease = (val >> 3) & 1;
+            ch->envelopePeriod = val & 7;
+            ch->dacEnabled = (val & 0xF8) != 0;
+            if (!ch->dacEnabled)
+                ch->enabled = 0;
+            break;
+        case 0xFF13:
+        case 0xFF18:
+        case 0xFF1D:
+            ch->frequency = (ch->frequency & 0x700) | val;
+            break;
+        case 0xFF14:
+        case 0xFF19:
+        case 0xFF1E:
+        case 0xFF23:
+            if (addr != 0xFF23)
+                ch->frequency = (ch->frequency & 0xFF) | ((val & 7) << 8);
+            ch->lengthEnable = (val >> 6) & 1;
+            if (val & 0x80)
+                trigger(c);
+            break;
+        case 0xFF1A:
+            ch->dacEnabled = val >> 7;
+            if (!ch->dacEnabled)
+                ch->enabled = 0;
+            break;
+        case 0xFF1B:
+            ch->length = 256 - val;
+            break;
+        case 0xFF1C:
+            ch->volumeShift = (val >> 5) & 3;
+            break;
+        case 0xFF20:
+            ch->length = 64 - (val & 0x3F);
+            break;
+        case 0xFF22:
+            ch->clockShift = val >> 4;
+            ch->widthMode = (val >> 3) & 1;
+            ch->divisorCode = val & 7;
+            break;
+        case 0xFF24:
+            leftVolume = (val >> 4) & 7;
+            rightVolume = val & 7;
+            break;
+        case 0xFF25:
+            panning = val;
+            break;
+        case 0xFF26:
+            if (power && !(val & 0x80))
+            {
+                // powering off clears every register but wave ram
+                memset(regs, 0, sizeof(regs));
+                for (uint8_t i = 0; i < CHANNELS; i++)
+                {
+                    ApuChannel *off = &channels[i];
+                    int32_t left = off->left;
+                    int32_t right = off->right;
+                    uint32_t next = off->next;
+                    memset(off, 0, sizeof(*off));
+                    off->left = left;
+                    off->right = right;
+                    off->next = next;
+                }
+                leftVolume = 0;
+                rightVolume = 0;
+                panning = 0;
+            }
+            else if (!power && (val & 0x80))
+                sequencerStep = 0;
+            power = val >> 7;
+            break;
+    }
+    for (uint8_t i = 0; i < CHANNELS; i++)
+        mix(i, clock);
+}
+
+void Apu_saveState(ApuState *state)
+{
+    run(clock);
+    memcpy(state->channels, channels, sizeof(channels));
+    for (uint8_t c = 0; c < CHANNELS; c++)
+        state->channels[c].next -= clock;
+    memcpy(state->regs, regs, sizeof(regs));
+    memcpy(state->waveRam, waveRam, sizeof(waveRam));
+    state->leftVolume = leftVolume;
+    state->rightVolume = rightVolume;
+    state->panning = panning;
+    state->power = power;
+    state->sequencerStep = sequencerStep;
+    state->sequencer = nextSequencer - clock;
+}
+
+// Output carries on from where it is, the loaded channels take over from now
+// Rejects anything the channels index tables or shift by
+uint8_t Apu_checkState(const ApuState *state)
+{
+    for (uint8_t c = 0; c < CHANNELS; c++)
+    {
+        const ApuChannel *ch = &state->channels[c];
+        if (ch->duty >= sizeof(dutyWaves) || ch->position >= (c == WAVE ? 32 : 8) ||
+            ch->volumeShift >= sizeof(waveShifts) || ch->divisorCode >= sizeof(noiseDivisors) ||
+            ch->clockShift >= 16)
+            return 0;
+    }
+    return state->sequencerStep < 8;
+}
+
+void Apu_loadState(const ApuState *state)
+{
+    run(clock);
+    for (uint8_t c = 0; c < CHANNELS; c++)
+    {
+        int32_t left = channels[c].left;
+        int32_t right = channels[c].right;
+        channels[c] = state->channels[c];
+        channels[c].next += clock;
+        channels[c].left = left;
+        channels[c].right = right;
+    }
+    memcpy(regs, state->regs, sizeof(regs));
+    memcpy(waveRam, state->waveRam, sizeof(waveRam));
+    leftVolume = state->leftVolume;
+    rightVolume = state->rightVolume;
+    panning = state->panning;
+    power = state->power;
+    sequencerStep = state->sequencerStep;
+    nextSequencer = clock + state->sequencer;
+    for (uint8_t c = 0; c < CHANNELS; c++)
+        mix(c, clock);
+}
@@ -0,0 +1,77 @@
+#ifndef APU_H
+#define APU_H
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint8_t enabled;
+    uint8_t dacEnabled;
+    uint8_t lengthEnable;
+    uint16_t length;
+    uint16_t frequency;
+    // cycle the timer next runs out, relative to the last flush
+    uint32_t next;
+    uint8_t position;
+
+    uint8_t volume;
+    uint8_t envelopeInitial;
+    uint8_t envelopeIncrease;
+    uint8_t envelopePeriod;
+    uint8_t envelopeTimer;
+
+    // square
+    uint8_t duty;
+
+    // square 1 sweep
+    uint8_t sweepPeriod;
+    uint8_t sweepNegate;
+    uint8_t sweepShift;
+    uint8_t sweepTimer;
+    uint8_t sweepEnabled;
+    uint16_t shadowFrequency;
+
+    // wave
+    uint8_t volumeShift;
+
+    // noise
+    uint16_t lfsr;
+    uint8_t clockShift;
+    uint8_t widthMode;
+    uint8_t divisorCode;
+
+    // what the channel currently adds to each side
+    int32_t left;
+    int32_t right;
+} ApuChannel;
+
+// Channel timers are saved relative to the moment of saving
+typedef struct
+{
+    ApuChannel channels[4];
+    uint8_t regs[0x20];
+    uint8_t waveRam[0x10];
+    uint8_t leftVolume;
+    uint8_t rightVolume;
+    uint8_t panning;
+    uint8_t power;
+    uint8_t sequencerStep;
+    // cycles to the next frame sequencer step
+    uint32_t sequencer;
+} ApuState;
+
+// Receives interleaved stereo samples each time the apu flushes
+typedef void (*ApuSink)(const int16_t *samples, uint32_t frames);
+
+void Apu_init(uint32_t sampleRate);
+void Apu_setSampleRate(uint32_t sampleRate);
+void Apu_addSink(ApuSink sink);
+void Apu_step(uint16_t ticks);
+void Apu_setSpeculative(uint8_t speculative);
+uint8_t Apu_rb(uint16_t addr);
+void Apu_wb(uint16_t addr, uint8_t val);
+void Apu_saveState(ApuState *state);
+uint8_t Apu_checkState(const ApuState *state);
+void Apu_loadState(const ApuState *state);
+
+#endif
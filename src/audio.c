@@ -0,0 +1,166 @@
+#include "audio.h"
+
+#include "apu.h"
+#include "debug.h"
+
+#include "SDL/SDL.h"
+
+#include <string.h>
+
+// Stereo frames between the apu and the device. Only the emulation thread
+// writes and only the audio callback reads, so head and tail are all the
+// synchronisation there is.
+#define RING_FRAMES 8192
+#define RING_MASK (RING_FRAMES - 1)
+
+// Frames requested from the device per callback
+#define DEVICE_FRAMES 512
+
+// The apu's output rate is nudged by up to this much either way to hold the
+// ring at its target, which soaks up the host and emulated clocks disagreeing
+#define MAX_RATE_DELTA 0.005
+
+static int16_t ring[RING_FRAMES * 2];
+static SDL_atomic_t ringHead = {0};
+static SDL_atomic_t ringTail = {0};
+
+static SDL_AudioDeviceID device = 0;
+static uint8_t playing = 0;
+static uint32_t deviceRate = 0;
+static uint8_t rateControl = 0;
+static int32_t targetFill = 0;
+static double averageFill = 0;
+
+// Audio_wait parks here until the callback has drained the ring
+static SDL_sem *drained = NULL;
+static SDL_atomic_t waiting = {0};
+
+// Held while the ring runs dry so an underrun is a gap rather than a click
+static int16_t lastFrame[2];
+static SDL_atomic_t underruns = {0};
+static uint32_t overruns = 0;
+
+// Head and tail count frames forever and wrap, so they're only ever used
+// unsigned where wrapping is defined
+static int32_t fill(void)
+{
+    return (uint32_t)SDL_AtomicGet(&ringHead) - (uint32_t)SDL_AtomicGet(&ringTail);
+}
+
+static void callback(void *data, uint8_t *stream, int length)
+{
+    (void)data;
+    int16_t *out = (int16_t *)stream;
+    uint32_t frames = length / 4;
+    uint32_t tail = SDL_AtomicGet(&ringTail);
+    uint32_t available = (uint32_t)SDL_AtomicGet(&ringHead) - tail;
+    SDL_MemoryBarrierAcquire();
+    uint32_t count = available < frames ? available : frames;
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t index = (tail + i) & RING_MASK;
+        out[i * 2] = ring[index * 2];
+        out[i * 2 + 1] = ring[index * 2 + 1];
+    }
+    if (count)
+        memcpy(lastFrame, &out[(count - 1) * 2], sizeof(lastFrame));
+    if (count < frames)
+        SDL_AtomicAdd(&underruns, 1);
+    for (uint32_t i = count; i < frames; i++)
+        memcpy(&out[i * 2], lastFrame, sizeof(lastFrame));
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ringTail, tail + count);
+    if (SDL_AtomicGet(&waiting))
+        SDL_SemPost(drained);
+}
+
+static void push(const int16_t *samples, uint32_t frames)
+{
+    uint32_t head = SDL_AtomicGet(&ringHead);
+    uint32_t space = RING_FRAMES - (head - (uint32_t)SDL_AtomicGet(&ringTail));
+    if (frames > space)
+    {
+        // only when fast forwarding, or with nothing draining the ring
+        overruns++;
+        frames = space;
+    }
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        uint32_t index = (head + i) & RING_MASK;
+        ring[index * 2] = samples[i * 2];
+        ring[index * 2 + 1] = samples[i * 2 + 1];
+    }
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&ringHead, head + frames);
+    // the device waits for a full ring so it doesn't start out underrunning
+    if (!playing && fill() >= targetFill)
+    {
+        SDL_PauseAudioDevice(device, 0);
+        playing = 1;
+    }
+
+    if (!rateControl)
+        return;
+    // dynamic rate control, a smoothed fill level steers the apu's rate
+    averageFill += (fill() - averageFill) / 16;
+    double delta = MAX_RATE_DELTA * (targetFill - averageFill) / (targetFill / 2);
+    if (delta > MAX_RATE_DELTA)
+        delta = MAX_RATE_DELTA;
+    else if (delta < -MAX_RATE_DELTA)
+        delta = -MAX_RATE_DELTA;
+    Apu_setSampleRate((uint32_t)(deviceRate * (1 + delta) + 0.5));
+}
+
+// Opens the default device and starts feeding it from the apu, returns 0 if
+// there's no audio to be had. A fixed rate leaves the apu at sampleRate for
+// anything else listening to it, and the device may under or overrun.
+uint8_t Audio_init(uint32_t sampleRate, uint8_t fixedRate)
+{
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO))
+    {
+        printf("Failed to initialise audio, continuing without sound\n");
+        return 0;
+    }
+    SDL_AudioSpec want;
+    SDL_AudioSpec have;
+    memset(&want, 0, sizeof(want));
+    want.freq = sampleRate;
+    want.format = AUDIO_S16SYS;
+    want.channels = 2;
+    want.samples = DEVICE_FRAMES;
+    want.callback = callback;
+    device = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+        fixedRate ? 0 : SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    drained = SDL_CreateSemaphore(0);
+    if (!device || !drained)
+    {
+        printf("Failed to open audio device, continuing without sound\n");
+        return 0;
+    }
+    deviceRate = have.freq;
+    // three device buffers queued keeps latency low without running dry
+    targetFill = have.samples * 3;
+    averageFill = targetFill;
+    rateControl = !fixedRate;
+    if (rateControl)
+        Apu_setSampleRate(deviceRate);
+    Apu_addSink(push);
+    return 1;
+}
+
+// Pacer hook for audio sync, holds the emulation back until the ring is
+// down to its target so the device's clock sets the pace
+void Audio_wait(void)
+{
+    SDL_AtomicSet(&waiting, 1);
+    while (fill() > targetFill)
+        SDL_SemWaitTimeout(drained, 10);
+    SDL_AtomicSet(&waiting, 0);
+    static uint32_t reported = 0;
+    uint32_t dropouts = SDL_AtomicGet(&underruns) + overruns;
+    if (dropouts != reported)
+    {
+        PRINT(("audio: %d underruns, %u overruns\n", SDL_AtomicGet(&underruns), overruns));
+        reported = dropouts;
+    }
+}
@@ -0,0 +1,9 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <stdint.h>
+
+uint8_t Audio_init(uint32_t sampleRate, uint8_t fixedRate);
+void Audio_wait(void);
+
+#endif
@@ -0,0 +1,142 @@
+#include "autosave.h"
+
+#include "file.h"
+#include "lz.h"
+#include "state.h"
+
+#include "SDL/SDL.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every so often the state is copied into a staging buffer between frames,
+// which is all the emulation pays for. A writer thread compresses it and
+// writes it out to the oldest of a rotating set of files, through a
+// temporary file and a rename so a crash never leaves a torn one. If the
+// writer is still busy when the next one is due, it waits for the next frame
+// boundary rather than the emulation waiting for the disk.
+#define AUTOSAVE_FILES 3
+#define AUTOSAVE_MAGIC "GBAUTOSV"
+#define HEADER_SIZE 16
+
+static uint8_t enabled = 0;
+static uint64_t interval = 0;
+static uint64_t due = 0;
+
+static uint32_t stateSize = 0;
+static uint8_t *staging = NULL;
+static SDL_atomic_t busy = {0};
+static SDL_sem *pending = NULL;
+static SDL_atomic_t stopping = {0};
+static SDL_Thread *writer = NULL;
+
+// Writer side
+static char paths[AUTOSAVE_FILES][4096];
+static uint8_t *packed = NULL;
+static uint32_t written = 0;
+
+static void writeAutosave(void)
+{
+    memcpy(packed, AUTOSAVE_MAGIC, 8);
+    File_put32(packed + 8, stateSize);
+    uint32_t size = Lz_compress(staging, stateSize, packed + HEADER_SIZE);
+    File_put32(packed + 12, size);
+    const char *path = paths[written % AUTOSAVE_FILES];
+    if (File_replace(path, packed, HEADER_SIZE + size))
+        written++;
+    else
+        printf("Failed to write autosave %s\n", path);
+}
+
+static int writeAutosaves(void *data)
+{
+    (void)data;
+    while (1)
+    {
+        SDL_SemWait(pending);
+        uint8_t stop = SDL_AtomicGet(&stopping);
+        if (SDL_AtomicGet(&busy))
+        {
+            SDL_MemoryBarrierAcquire();
+            writeAutosave();
+            SDL_AtomicSet(&busy, 0);
+        }
+        if (stop)
+            return 0;
+    }
+}
+
+// Writes the state every given number of seconds to <rom>.auto1.state and on
+void Autosave_start(const char *romFile, uint32_t seconds)
+{
+    for (int i = 0; i < AUTOSAVE_FILES; i++)
+    {
+        char extension[32];
+        snprintf(extension, sizeof(extension), ".auto%d.state", i + 1);
+        State_path(paths[i], sizeof(paths[i]), romFile, extension);
+    }
+    stateSize = State_size();
+    staging = malloc(stateSize);
+    packed = malloc(HEADER_SIZE + Lz_bound(stateSize));
+    // touched now, so the first copy doesn't fault every page in
+    if (staging)
+        memset(staging, 0, stateSize);
+    pending = SDL_CreateSemaphore(0);
+    writer = staging && packed && pending ? SDL_CreateThread(writeAutosaves, "autosave", NULL) : NULL;
+    if (!writer)
+    {
+        printf("Failed to start autosave writer thread\n");
+        exit(1);
+    }
+    interval = seconds * SDL_GetPerformanceFrequency();
+    due = SDL_GetPerformanceCounter() + interval;
+    enabled = 1;
+    atexit(Autosave_stop);
+}
+
+// Lets the writer finish the one it has
+void Autosave_stop(void)
+{
+    if (!enabled)
+        return;
+    enabled = 0;
+    SDL_AtomicSet(&stopping, 1);
+    SDL_SemPost(pending);
+    SDL_WaitThread(writer, NULL);
+    if (written)
+        printf("wrote %u autosaves, newest %s\n", written, paths[(written - 1) % AUTOSAVE_FILES]);
+}
+
+void Autosave_frame(void)
+{
+    if (!enabled)
+        return;
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (now < due || SDL_AtomicGet(&busy))
+        return;
+    State_write(staging);
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&busy, 1);
+    SDL_SemPost(pending);
+    due = now + interval;
+}
+
+// Registered as the state loader, so autosaves load like any other state
+uint8_t Autosave_read(const uint8_t *file, uint32_t size)
+{
+    if (size < HEADER_SIZE || memcmp(file, AUTOSAVE_MAGIC, 8))
+        return State_read(file, size);
+    uint32_t unpackedSize = File_get32(file + 8);
+    uint32_t packedSize = File_get32(file + 12);
+    // sizes from the file are checked before anything is allocated for them
+    uint8_t *image = unpackedSize == State_size() && packedSize == size - HEADER_SIZE ?
+        malloc(unpackedSize) : NULL;
+    uint8_t ok = 0;
+    if (image && Lz_decompress(file + HEADER_SIZE, packedSize, image, unpackedSize) == unpackedSize)
+        ok = State_read(image, unpackedSize);
+    else
+        printf("Save state is truncated or malformed\n");
+    free(image);
+    return ok;
+}
@@ -0,0 +1,11 @@
+#ifndef AUTOSAVE_H
+#define AUTOSAVE_H
+
+#include <stdint.h>
+
+void Autosave_start(const char *romFile, uint32_t seconds);
+void Autosave_stop(void);
+void Autosave_frame(void);
+uint8_t Autosave_read(const uint8_t *file, uint32_t size);
+
+#endif
@@ -0,0 +1,69 @@
+#include "cache.h"
+
+#include "cartridge.h"
+#include "state.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+// The start cache is a save state taken once the intros are over. It's named
+// after the rom hash and the state version, so another rom or a build that
+// lays the state out differently never picks it up, and a later launch just
+// maps it in. The cartridge ram as loaded from the .sav goes into the name
+// too: the state carries that ram on, and the intro may have read it.
+static char path[4096];
+static uint8_t enabled = 0;
+static uint32_t target = 0;
+static uint32_t frames = 0;
+static uint8_t markRequested = 0;
+
+// State_save replaces the file whole, so a launch running alongside never
+// maps half a state
+static void store(void)
+{
+    if (State_save(path))
+        printf("cached start state to %s after %u frames\n", path, frames);
+}
+
+// Resumes from the cache if there's a good one. Otherwise it's taken once the
+// given number of frames have run, or at f6 when that is 0. Called once the
+// .sav is loaded and before anything has run.
+uint8_t Cache_start(const char *romFile, uint32_t frames)
+{
+    uint64_t ramHash = 1469598103934665603ULL;
+    const uint8_t *ram = Cartridge_externalRam();
+    for (uint32_t i = 0; i < MAX_EXTERNAL_RAM_SIZE; i++)
+        ramHash = (ramHash ^ ram[i]) * 1099511628211ULL;
+    char extension[64];
+    snprintf(extension, sizeof(extension), ".%016" PRIx64 ".%016" PRIx64 ".v%d.start",
+        Cartridge_hash(), ramHash, STATE_VERSION);
+    State_path(path, sizeof(path), romFile, extension);
+    enabled = 1;
+    target = frames;
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+    fclose(file);
+    if (!State_load(path))
+        return 0;
+    target = 0;
+    return 1;
+}
+
+void Cache_mark(void)
+{
+    markRequested = enabled;
+}
+
+void Cache_frame(void)
+{
+    if (!enabled)
+        return;
+    frames++;
+    if (markRequested || frames == target)
+    {
+        markRequested = 0;
+        store();
+    }
+}
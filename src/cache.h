@@ -0,0 +1,10 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <stdint.h>
+
+uint8_t Cache_start(const char *romFile, uint32_t frames);
+void Cache_mark(void);
+void Cache_frame(void);
+
+#endif
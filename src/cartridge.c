@@ -1,12 +1,14 @@
 #include "cartridge.h"
 
+#include "snapshot.h"
+
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #define MAX_CART_SIZE 1 << 21
-#define MAX_EXTERNAL_RAM_SIZE 1 << 15
 
 static uint8_t cart[MAX_CART_SIZE];
 static uint8_t externalRam[MAX_EXTERNAL_RAM_SIZE];
@@ -53,6 +55,9 @@ static uint8_t romRamModeSelect = 0;
 
 static struct tm timeRegister = {};
 
+// FNV-1a of the rom as loaded, identifies it for save states
+static uint64_t romHash = 0;
+
 uint8_t isSupportedCartridge(uint8_t cartType)
 {
     for (uint8_t i = 0; i < NUM_SUPPORTED; i++)
@@ -141,11 +146,15 @@ void Cartridge_load(const char *filename)
         printf("Failed to open rom %s\n", filename);
         exit(1);
     }
-    if (!fread(cart, 1, MAX_CART_SIZE, cartridge))
+    size_t size = fread(cart, 1, MAX_CART_SIZE, cartridge);
+    if (!size)
     {
         printf("Failed to read from cart\n");
         exit(1);
     }
+    romHash = 1469598103934665603ULL;
+    for (size_t i = 0; i < size; i++)
+        romHash = (romHash ^ cart[i]) * 1099511628211ULL;
     if (fclose(cartridge))
     {
         printf("Failed to close cart\n");
@@ -210,7 +219,9 @@ void Cartridge_wb(uint16_t addr, uint8_t val)
     {
         if (!externalRamEnable)
             return;
-        externalRam[translateMBCRamAddr(addr)] = val;
+        uint32_t ramAddr = translateMBCRamAddr(addr);
+        externalRam[ramAddr] = val;
+        Snapshot_touch(PAGE_EXTERNAL_RAM + (ramAddr >> SNAPSHOT_PAGE_SHIFT));
         return;
     }
     assert(0);
@@ -284,3 +295,43 @@ void Cartridge_writeSaveFile(void)
         exit(1);
     }
 }
+
+uint64_t Cartridge_hash(void)
+{
+    return romHash;
+}
+
+uint8_t *Cartridge_externalRam(void)
+{
+    return externalRam;
+}
+
+void Cartridge_saveState(CartridgeState *state)
+{
+    state->externalRamEnable = externalRamEnable;
+    state->romBankSelect = romBankSelect;
+    state->ramBankSelect = ramBankSelect;
+    state->romRamModeSelect = romRamModeSelect;
+    state->seconds = timeRegister.tm_sec;
+    state->minutes = timeRegister.tm_min;
+    state->hours = timeRegister.tm_hour;
+    state->days = timeRegister.tm_yday;
+}
+
+// Ram banks go up to 3, and the MBC3 clock registers are 8 to 0xC
+uint8_t Cartridge_checkState(const CartridgeState *state)
+{
+    return state->ramBankSelect <= 3 || (state->ramBankSelect >= 0x8 && state->ramBankSelect <= 0xC);
+}
+
+void Cartridge_loadState(const CartridgeState *state)
+{
+    externalRamEnable = state->externalRamEnable;
+    romBankSelect = state->romBankSelect;
+    ramBankSelect = state->ramBankSelect;
+    romRamModeSelect = state->romRamModeSelect;
+    timeRegister.tm_sec = state->seconds;
+    timeRegister.tm_min = state->minutes;
+    timeRegister.tm_hour = state->hours;
+    timeRegister.tm_yday = state->days;
+}
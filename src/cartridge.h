@@ -3,10 +3,30 @@
 
 #include <stdint.h>
 
+#define MAX_EXTERNAL_RAM_SIZE (1 << 15)
+
+typedef struct
+{
+    uint8_t externalRamEnable;
+    uint8_t romBankSelect;
+    uint8_t ramBankSelect;
+    uint8_t romRamModeSelect;
+    // latched MBC3 clock
+    uint8_t seconds;
+    uint8_t minutes;
+    uint8_t hours;
+    uint16_t days;
+} CartridgeState;
+
 void Cartridge_load(const char *filename);
 uint8_t Cartridge_rb(uint16_t addr);
 void Cartridge_wb(uint16_t addr, uint8_t val);
 uint8_t *Cartridge_rawAddress(uint32_t addr);
 void Cartridge_writeSaveFile(void);
+uint64_t Cartridge_hash(void);
+uint8_t *Cartridge_externalRam(void);
+void Cartridge_saveState(CartridgeState *state);
+uint8_t Cartridge_checkState(const CartridgeState *state);
+void Cartridge_loadState(const CartridgeState *state);
 
 #endif
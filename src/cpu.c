@@ -1,6 +1,7 @@
 #include "cpu.h"
 
 #include "debug.h"
+#include "machine.h"
 #include "memory.h"
 
 static struct
@@ -12,6 +13,53 @@ static struct
     uint8_t halted;
 } r;
 
+#ifdef CYCLE_STEPPED
+// Each bus access after the opcode fetch starts a new M-cycle, so the rest of
+// the machine is stepped before it happens and sees the access at the right
+// time. Whatever the instruction takes beyond its accesses is returned from
+// Cpu_step as usual.
+static uint8_t busAccesses = 0;
+static uint8_t busTicks = 0;
+
+static void busCycle(void)
+{
+    if (busAccesses++)
+    {
+        Machine_tick(4);
+        busTicks += 4;
+    }
+}
+
+static uint8_t steppedRb(uint16_t addr)
+{
+    busCycle();
+    return Mem_rb(addr);
+}
+
+static void steppedWb(uint16_t addr, uint8_t val)
+{
+    busCycle();
+    Mem_wb(addr, val);
+}
+
+static uint16_t steppedRw(uint16_t addr)
+{
+    uint8_t low = steppedRb(addr);
+    return low + ((uint16_t)steppedRb(addr + 1) << 8);
+}
+
+static void steppedWw(uint16_t addr, uint16_t val)
+{
+    steppedWb(addr, val & 255);
+    steppedWb(addr + 1, val >> 8);
+}
+
+#define Mem_rb steppedRb
+#define Mem_wb steppedWb
+#define Mem_rw steppedRw
+#define Mem_ww steppedWw
+#endif
+
 static void dispatch(uint8_t op);
 #ifdef DEBUG_CPU
 static const char *opName(uint8_t op);
@@ -31,12 +79,57 @@ uint8_t Cpu_step(void)
 {
     if (r.halted)
         return 4;
+#ifdef CYCLE_STEPPED
+    busAccesses = 0;
+    busTicks = 0;
+#endif
     CPU_PRINT(("--------------\n"));
     uint8_t op = Mem_rb(r.pc++);
     CPU_PRINT(("op %s\n", opName(op)));
     dispatch(op);
     printCpu();
+#ifdef CYCLE_STEPPED
+    return busTicks < r.m * 4 ? r.m * 4 - busTicks : 0;
+#else
     return r.m * 4;
+#endif
+}
+
+uint8_t Cpu_halted(void)
+{
+    return r.halted;
+}
+
+void Cpu_saveState(CpuState *state)
+{
+    state->a = r.a;
+    state->b = r.b;
+    state->c = r.c;
+    state->d = r.d;
+    state->e = r.e;
+    state->h = r.h;
+    state->l = r.l;
+    state->f = r.f;
+    state->pc = r.pc;
+    state->sp = r.sp;
+    state->ime = r.ime;
+    state->halted = r.halted;
+}
+
+void Cpu_loadState(const CpuState *state)
+{
+    r.a = state->a;
+    r.b = state->b;
+    r.c = state->c;
+    r.d = state->d;
+    r.e = state->e;
+    r.h = state->h;
+    r.l = state->l;
+    r.f = state->f;
+    r.pc = state->pc;
+    r.sp = state->sp;
+    r.ime = state->ime;
+    r.halted = state->halted;
 }
 
 // --- Instructions
@@ -711,6 +804,14 @@ static void dispatch(uint8_t op)
     }
 }
 
+#ifdef CYCLE_STEPPED
+// Looking at IF and IE to decide on an interrupt isn't a bus access
+#undef Mem_rb
+#undef Mem_wb
+#undef Mem_rw
+#undef Mem_ww
+#endif
+
 void Cpu_interrupts(void)
 {
     uint8_t interruptFlag = Mem_rb(0xFF0F);
@@ -725,6 +826,12 @@ void Cpu_interrupts(void)
     if (permittedInterrupts)
     {
         r.ime = 0;
+#ifdef CYCLE_STEPPED
+        // dispatch is two idle M-cycles, the two pushes and the jump
+        busAccesses = 1;
+        busTicks = 4;
+        Machine_tick(4);
+#endif
         if (permittedInterrupts & 0x1)
         {
             // vblank interrupt
@@ -760,6 +867,9 @@ void Cpu_interrupts(void)
             interruptFlag &= ~0x10;
             CALL(0x60);
         }
+#ifdef CYCLE_STEPPED
+        Machine_tick(20 - busTicks);
+#endif
         Mem_wb(0xFF0F, interruptFlag);
     }
 }
@@ -3,8 +3,19 @@
 
 #include <stdint.h>
 
+typedef struct
+{
+    uint8_t a, b, c, d, e, h, l, f;
+    uint16_t pc, sp;
+    uint8_t ime;
+    uint8_t halted;
+} CpuState;
+
 void Cpu_init(void);
 uint8_t Cpu_step(void);
+uint8_t Cpu_halted(void);
 void Cpu_interrupts(void);
+void Cpu_saveState(CpuState *state);
+void Cpu_loadState(const CpuState *state);
 
 #endif
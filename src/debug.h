@@ -11,8 +11,10 @@ extern uint8_t enableDebugPrints;
 // #define DEBUG_TIMER
 // #define DEBUG_INPUT
 // #define DEBUG_INTERRUPTS
+// #define DEBUG_APU
 // #define DISABLE_RENDER
 // #define DEBUG_TILES
+// #define CYCLE_STEPPED
 #define SKIP_BOOTROM
 
 #define PRINT(x) if (enableDebugPrints) printf x
@@ -55,4 +57,10 @@ extern uint8_t enableDebugPrints;
 #define INT_PRINT(x)
 #endif
 
+#ifdef DEBUG_APU
+#define APU_PRINT(x) PRINT(x)
+#else
+#define APU_PRINT(x)
+#endif
+
 #endif
@@ -0,0 +1,321 @@
+#include "fifo.h"
+
+#include <string.h>
+
+// A dot by dot model of mode 3. A fetcher reads the background or window one
+// tile row at a time into a pixel FIFO, sprites are fetched into a second
+// FIFO as the output position reaches them, and one pixel leaves per dot.
+// Registers and memory are read at the dot they matter, so writes made while
+// the line is being drawn land mid line, and the time the line takes varies
+// with SCX, the window and sprites the way mode 3 does on hardware.
+
+#define LCDC_WINDOW_MAP(lcdc) (((lcdc) >> 6) & 1)
+#define LCDC_WINDOW(lcdc) (((lcdc) >> 5) & 1)
+#define LCDC_TILE_DATA(lcdc) (((lcdc) >> 4) & 1)
+#define LCDC_BG_MAP(lcdc) (((lcdc) >> 3) & 1)
+#define LCDC_SPRITE_SIZE(lcdc) (((lcdc) >> 2) & 1)
+#define LCDC_SPRITES(lcdc) (((lcdc) >> 1) & 1)
+#define LCDC_BG(lcdc) ((lcdc) & 1)
+
+#define MAX_LINE_SPRITES 10
+#define NUM_SPRITES 40
+
+// The first fetch of a line is thrown away, and each fetcher step takes two
+// dots
+#define STARTUP_DOTS 6
+#define SPRITE_FETCH_DOTS 6
+
+typedef enum {
+    FETCH_TILE,
+    FETCH_LOW,
+    FETCH_HIGH,
+    FETCH_PUSH
+} FetchStep;
+
+typedef struct
+{
+    uint8_t color;
+    uint8_t palette;
+    uint8_t behindBg;
+} ObjPixel;
+
+static uint8_t line = 0;
+static uint16_t dots = 0;
+static uint8_t x = 0;
+static uint8_t discard = 0;
+static uint8_t startup = 0;
+
+static uint8_t bgFifo[8];
+static uint8_t bgCount = 0;
+static uint8_t bgHead = 0;
+static ObjPixel objFifo[8];
+
+static FetchStep step = FETCH_TILE;
+static uint8_t stepDots = 0;
+static uint8_t fetchX = 0;
+static uint8_t tile = 0;
+static uint8_t low = 0;
+static uint8_t high = 0;
+
+// Window state, the line counter only advances on lines the window drew
+static uint8_t inWindow = 0;
+static uint8_t windowTriggered = 0;
+static uint8_t windowLine = 0;
+static uint8_t windowUsed = 0;
+
+static uint8_t sprites[MAX_LINE_SPRITES];
+static uint8_t spriteCount = 0;
+static uint8_t spriteFetched[MAX_LINE_SPRITES];
+static int8_t spriteFetch = -1;
+static uint8_t spriteFetchDots = 0;
+
+void Fifo_startFrame(void)
+{
+    windowTriggered = 0;
+    windowLine = 0;
+    windowUsed = 0;
+}
+
+// Mode 2, up to 10 sprites overlapping the line in OAM order
+static void scanOam(const uint8_t *oam, const LineRegs *regs)
+{
+    uint8_t height = LCDC_SPRITE_SIZE(regs->lcdc) ? 16 : 8;
+    spriteCount = 0;
+    for (uint8_t sprite = 0; sprite < NUM_SPRITES && spriteCount < MAX_LINE_SPRITES; sprite++)
+    {
+        int16_t top = oam[sprite * 4] - 16;
+        if (line >= top && line < top + height)
+            sprites[spriteCount++] = sprite;
+    }
+    memset(spriteFetched, 0, sizeof(spriteFetched));
+}
+
+void Fifo_startLine(const uint8_t *vram, const uint8_t *oam,
+    const LineRegs *regs, uint8_t line_)
+{
+    (void)vram;
+    if (windowUsed)
+        windowLine++;
+    windowUsed = 0;
+    line = line_;
+    if (line == regs->windowY)
+        windowTriggered = 1;
+    dots = 0;
+    x = 0;
+    discard = regs->scrollX & 7;
+    startup = STARTUP_DOTS;
+    bgCount = 0;
+    bgHead = 0;
+    memset(objFifo, 0, sizeof(objFifo));
+    step = FETCH_TILE;
+    stepDots = 0;
+    fetchX = 0;
+    inWindow = 0;
+    spriteFetch = -1;
+    scanOam(oam, regs);
+}
+
+uint8_t Fifo_done(void)
+{
+    return x == SCREEN_WIDTH;
+}
+
+uint16_t Fifo_dots(void)
+{
+    return dots;
+}
+
+static uint16_t tileAddr(const LineRegs *regs, uint8_t tileIndex, uint8_t fineY)
+{
+    if (LCDC_TILE_DATA(regs->lcdc))
+        return tileIndex * 16 + fineY * 2;
+    return 0x1000 + (int8_t)tileIndex * 16 + fineY * 2;
+}
+
+static uint8_t fetchY(const LineRegs *regs)
+{
+    return inWindow ? windowLine : (uint8_t)(line + regs->scrollY);
+}
+
+static void fetcherDot(const uint8_t *vram, const LineRegs *regs)
+{
+    if (step != FETCH_PUSH && ++stepDots < 2)
+        return;
+    stepDots = 0;
+    uint8_t y = fetchY(regs);
+    switch (step)
+    {
+        case FETCH_TILE:
+        {
+            uint16_t map;
+            uint8_t col;
+            if (inWindow)
+            {
+                map = LCDC_WINDOW_MAP(regs->lcdc) ? 0x1C00 : 0x1800;
+                col = fetchX;
+            }
+            else
+            {
+                map = LCDC_BG_MAP(regs->lcdc) ? 0x1C00 : 0x1800;
+                col = (regs->scrollX / 8 + fetchX) & 31;
+            }
+            tile = vram[map + (y / 8) * 32 + col];
+            step = FETCH_LOW;
+            break;
+        }
+        case FETCH_LOW:
+            low = vram[tileAddr(regs, tile, y & 7)];
+            step = FETCH_HIGH;
+            break;
+        case FETCH_HIGH:
+            high = vram[tileAddr(regs, tile, y & 7) + 1];
+            step = FETCH_PUSH;
+            break;
+        case FETCH_PUSH:
+            // the row only goes in once the FIFO has run dry
+            if (bgCount)
+                return;
+            for (uint8_t i = 0; i < 8; i++)
+                bgFifo[i] = ((low >> (7 - i)) & 1) | (((high >> (7 - i)) & 1) << 1);
+            bgCount = 8;
+            bgHead = 0;
+            fetchX++;
+            step = FETCH_TILE;
+            break;
+    }
+}
+
+// Sprite pixels already in the FIFO came from a sprite with a lower X or an
+// earlier OAM slot, so they keep priority over this one
+static void mergeSprite(const uint8_t *vram, const uint8_t *oam, const LineRegs *regs,
+    uint8_t sprite)
+{
+    const uint8_t *entry = oam + sprite * 4;
+    uint8_t height = LCDC_SPRITE_SIZE(regs->lcdc) ? 16 : 8;
+    uint8_t flags = entry[3];
+    uint8_t y = line - (entry[0] - 16);
+    if ((flags >> 6) & 1)
+        y = height - 1 - y;
+    uint8_t tileIndex = height == 16 ? entry[2] & 0xFE : entry[2];
+    uint16_t addr = tileIndex * 16 + y * 2;
+    uint8_t spriteLow = vram[addr];
+    uint8_t spriteHigh = vram[addr + 1];
+    // sprites hanging off the left edge lose their first columns
+    uint8_t skip = entry[1] < 8 ? 8 - entry[1] : 0;
+    for (uint8_t i = skip; i < 8; i++)
+    {
+        uint8_t bit = (flags >> 5) & 1 ? i : 7 - i;
+        uint8_t color = ((spriteLow >> bit) & 1) | (((spriteHigh >> bit) & 1) << 1);
+        ObjPixel *pixel = &objFifo[i - skip];
+        if (pixel->color || !color)
+            continue;
+        pixel->color = color;
+        pixel->palette = (flags >> 4) & 1;
+        pixel->behindBg = (flags >> 7) & 1;
+    }
+}
+
+// The sprite whose left edge the output has reached, lowest X first so the
+// one in front claims the FIFO. Sprites hanging off the left edge are all
+// due at once at the first pixel.
+static int8_t spriteDue(const uint8_t *oam)
+{
+    int8_t due = -1;
+    for (uint8_t i = 0; i < spriteCount; i++)
+    {
+        uint8_t spriteX = oam[sprites[i] * 4 + 1];
+        if (spriteFetched[i] || spriteX > x + 8)
+            continue;
+        if (due < 0 || spriteX < oam[sprites[due] * 4 + 1])
+            due = i;
+    }
+    return due;
+}
+
+static void popPixel(const LineRegs *regs, uint8_t *out)
+{
+    uint8_t bgColor = bgFifo[bgHead++];
+    bgCount--;
+    ObjPixel obj = objFifo[0];
+    memmove(objFifo, objFifo + 1, sizeof(objFifo) - sizeof(objFifo[0]));
+    memset(&objFifo[7], 0, sizeof(objFifo[7]));
+    if (discard)
+    {
+        discard--;
+        return;
+    }
+
+    uint8_t shade = 0;
+    if (LCDC_BG(regs->lcdc))
+        shade = (regs->bgPalette >> (bgColor * 2)) & 3;
+    else
+        bgColor = 0;
+    if (obj.color && LCDC_SPRITES(regs->lcdc) && !(obj.behindBg && bgColor))
+    {
+        uint8_t palette = obj.palette ? regs->objPalette1 : regs->objPalette0;
+        shade = (palette >> (obj.color * 2)) & 3;
+    }
+    out[x++] = shade;
+}
+
+static void dot(const uint8_t *vram, const uint8_t *oam, const LineRegs *regs,
+    uint8_t *out)
+{
+    dots++;
+    if (startup)
+    {
+        startup--;
+        return;
+    }
+
+    // a sprite fetch stalls everything until its pixels are in
+    if (spriteFetch >= 0)
+    {
+        if (--spriteFetchDots)
+            return;
+        mergeSprite(vram, oam, regs, sprites[spriteFetch]);
+        spriteFetched[spriteFetch] = 1;
+        spriteFetch = -1;
+    }
+
+    // switching to the window restarts the fetcher on an empty FIFO
+    if (!inWindow && LCDC_WINDOW(regs->lcdc) && windowTriggered &&
+        !discard && x + 7 >= regs->windowX)
+    {
+        inWindow = 1;
+        windowUsed = 1;
+        bgCount = 0;
+        // below 7 the window starts left of the screen
+        if (regs->windowX < 7)
+            discard = 7 - regs->windowX;
+        fetchX = 0;
+        step = FETCH_TILE;
+        stepDots = 0;
+    }
+
+    // a sprite is fetched once the output reaches its left edge, after the
+    // background fetch in progress has filled the FIFO
+    int8_t due = LCDC_SPRITES(regs->lcdc) && !discard ? spriteDue(oam) : -1;
+    if (due >= 0)
+    {
+        if (!bgCount)
+        {
+            fetcherDot(vram, regs);
+            return;
+        }
+        spriteFetch = due;
+        spriteFetchDots = SPRITE_FETCH_DOTS;
+        return;
+    }
+
+    fetcherDot(vram, regs);
+    if (bgCount)
+        popPixel(regs, out);
+}
+
+void Fifo_run(const uint8_t *vram, const uint8_t *oam, const LineRegs *regs,
+    uint16_t dots_, uint8_t *out)
+{
+    while (dots_-- && !Fifo_done())
+        dot(vram, oam, regs, out);
+}
@@ -0,0 +1,16 @@
+#ifndef FIFO_H
+#define FIFO_H
+
+#include "renderer.h"
+
+#include <stdint.h>
+
+void Fifo_startFrame(void);
+void Fifo_startLine(const uint8_t *vram, const uint8_t *oam,
+    const LineRegs *regs, uint8_t line);
+void Fifo_run(const uint8_t *vram, const uint8_t *oam, const LineRegs *regs,
+    uint16_t dots, uint8_t *out);
+uint8_t Fifo_done(void);
+uint16_t Fifo_dots(void);
+
+#endif
@@ -0,0 +1,70 @@
+#include "file.h"
+
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// Everything written to disk is little endian, whatever the host
+void File_put16(uint8_t *out, uint16_t val)
+{
+    out[0] = val;
+    out[1] = val >> 8;
+}
+
+void File_put32(uint8_t *out, uint32_t val)
+{
+    File_put16(out, val);
+    File_put16(out + 2, val >> 16);
+}
+
+void File_put64(uint8_t *out, uint64_t val)
+{
+    File_put32(out, val);
+    File_put32(out + 4, val >> 32);
+}
+
+uint32_t File_get32(const uint8_t *in)
+{
+    return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+uint64_t File_get64(const uint8_t *in)
+{
+    return File_get32(in) | (uint64_t)File_get32(in + 4) << 32;
+}
+
+// Writes a temporary file named after the process, syncs it and renames it
+// over the old one. Whoever opens the path, alongside or after a crash, gets
+// either the old file or the new one whole. Safe to call from any thread.
+uint8_t File_replace(const char *path, const void *data, uint32_t size)
+{
+    char tempPath[4096 + 32];
+#ifdef _WIN32
+    unsigned long process = GetCurrentProcessId();
+#else
+    unsigned long process = getpid();
+#endif
+    snprintf(tempPath, sizeof(tempPath), "%s.%lu.tmp", path, process);
+    FILE *file = fopen(tempPath, "wb");
+    uint8_t ok = file && fwrite(data, 1, size, file) == size && !fflush(file);
+#ifdef _WIN32
+    ok = ok && !_commit(_fileno(file));
+#else
+    ok = ok && !fsync(fileno(file));
+#endif
+    if (file && fclose(file))
+        ok = 0;
+#ifdef _WIN32
+    ok = ok && MoveFileExA(tempPath, path, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && !rename(tempPath, path);
+#endif
+    if (!ok)
+        remove(tempPath);
+    return ok;
+}
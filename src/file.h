@@ -0,0 +1,13 @@
+#ifndef FILE_H
+#define FILE_H
+
+#include <stdint.h>
+
+void File_put16(uint8_t *out, uint16_t val);
+void File_put32(uint8_t *out, uint32_t val);
+void File_put64(uint8_t *out, uint64_t val);
+uint32_t File_get32(const uint8_t *in);
+uint64_t File_get64(const uint8_t *in);
+uint8_t File_replace(const char *path, const void *data, uint32_t size);
+
+#endif
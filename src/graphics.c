@@ -1,16 +1,26 @@
 #include "graphics.h"
 
+#include "cache.h"
 #include "cartridge.h"
 #include "debug.h"
+#include "fifo.h"
 #include "input.h"
+#include "movie.h"
+#include "pacer.h"
+#include "palette.h"
+#include "recorder.h"
+#include "renderer.h"
+#include "rewind.h"
+#include "scaler.h"
+#include "snapshot.h"
+#include "state.h"
 
 #include "SDL/SDL.h"
 
-#include "windows.h"
-
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 static SDL_Window *window = NULL;
 static SDL_Surface *screen = NULL;
@@ -23,20 +33,51 @@ static SDL_Renderer *debug_renderer = NULL;
 void drawDebugTiles(void);
 #endif
 
-static uint8_t vram[0x2000];
-static uint8_t oam[0xA0];
+static SDL_Texture *texture = NULL;
+
+static uint8_t vram[VRAM_SIZE];
+static uint8_t oam[OAM_SIZE];
 static uint16_t clock = 0;
 
-#define WIDTH 160
-#define HEIGHT 144
+#ifdef DEBUG_TILES
 static uint8_t s_scale = 3;
-static LARGE_INTEGER freq;
+#endif
 
-#define NUM_COLORS 4
-static uint8_t s_colors[NUM_COLORS] = {232, 160, 88, 16};
+#ifndef DISABLE_RENDER
+// Lines are drawn in one batch at vblank from what the frame did to VRAM, OAM
+// and the registers, rather than interleaved with the cpu
+static FrameLog frameLogs[3];
+static FrameLog *frameLog = &frameLogs[0];
+static uint32_t frameNumber = 0;
+#endif
 
-#define CLOCK_HZ 4194304
-#define CLOCKS_PER_FRAME 70224
+// With a render thread the emulation thread only fills in frame logs and the
+// main thread composes and presents them. The logs form a triple buffer: the
+// emulation thread owns one, the render thread owns one, and the one in
+// between is swapped atomically, tagged when it holds a frame not yet taken.
+// Neither side ever waits for the other, the render thread just draws the
+// newest frame and the renderer reloads from the frame's start state when it
+// missed some.
+#define FRAME_READY 4
+static uint8_t threaded = 0;
+static SDL_Thread *emulation = NULL;
+#ifndef DISABLE_RENDER
+static SDL_atomic_t middleFrame = {1};
+static uint8_t backFrame = 0;
+static uint8_t frontFrame = 2;
+#endif
+static SDL_sem *frameReady = NULL;
+
+// Set on quit, the emulation stops at the end of its frame so nothing it
+// writes to is closed under it
+static SDL_atomic_t quitting = {0};
+
+// Key events cross from the render thread to the emulation thread through a
+// single producer single consumer ring, drained once per frame
+#define KEY_QUEUE_SIZE 64
+static SDL_Event keyQueue[KEY_QUEUE_SIZE];
+static SDL_atomic_t keyHead = {0};
+static SDL_atomic_t keyTail = {0};
 
 typedef enum {
     HBLANK,
@@ -90,12 +131,49 @@ static uint8_t windowScrollY;
 // FF4B - Window Scroll X
 static uint8_t windowScrollX;
 
+// Whether the frame in progress is composed and presented
+static uint8_t drawFrame = 1;
+
+// Frames run ahead or thrown away are hidden, or held back for the caller
+// to present once the machine is back where it belongs
+static GraphicsOutput output = OUTPUT_SHOWN;
+static uint8_t held = 0;
+
+// The FIFO engine draws mode 3 dot by dot as the cpu runs, the scanline
+// engine leaves it all to the renderer. Switches wait for the next frame.
+static PpuEngine engine = PPU_SCANLINE;
+static PpuEngine nextEngine = PPU_SCANLINE;
+static uint8_t fifoLine[SCREEN_WIDTH];
+
+// Mode 3 is 172 cycles unless the FIFO engine found the line took longer,
+// hblank gives the difference back
+#define MIN_MODE3_CYCLES 172
+static uint16_t mode3Cycles = MIN_MODE3_CYCLES;
+
+// Set when the whole screen has to be uploaded again in new colours
+static uint8_t paletteChanged = 0;
+
 // V-Blank Interrupt Request
 static uint8_t vblankInterruptRequest = 0;
 
 // Status Interrupt Request
 static uint8_t statusInterruptRequest = 0;
 
+// Vblanks entered, whether or not the frame was rendered
+static uint32_t frames = 0;
+
+static uint8_t lcdControl(void)
+{
+    return (lcdDisplayEnable << 7) |
+           (windowTileMapSelect << 6) |
+           (windowDisplayEnable << 5) |
+           (tileDataSelect << 4) |
+           (bgTileMapSelect << 3) |
+           (spriteSize << 2) |
+           (spriteDisplayEnable << 1) |
+           (bgDisplay);
+}
+
 void cleanup(void)
 {
     Cartridge_writeSaveFile();
@@ -110,8 +188,11 @@ void Graphics_init(void)
         exit(1);
     }
     atexit(cleanup);
+    // the frame is scaled up on the cpu and the texture is already window
+    // sized, so the renderer never has to stretch it
+    uint8_t factor = Scaler_factor();
     window = SDL_CreateWindow(
-        "Gameboy", 500, 250,  WIDTH * s_scale, HEIGHT * s_scale, 0
+        "Gameboy", 500, 250,  SCREEN_WIDTH * factor, SCREEN_HEIGHT * factor, 0
     );
     if (!window)
     {
@@ -124,7 +205,8 @@ void Graphics_init(void)
         printf("Failed to get window surface\n");
         exit(1);
     }
-    renderer = SDL_CreateRenderer(window, -1, 0);
+    uint32_t rendererFlags = Pacer_mode() == PACER_VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0;
+    renderer = SDL_CreateRenderer(window, -1, rendererFlags);
     if (!renderer)
     {
         printf("Failed to create renderer\n");
@@ -141,11 +223,16 @@ void Graphics_init(void)
     }
     SDL_RenderSetScale(debug_renderer, s_scale, s_scale);
 #endif
-    SDL_RenderSetScale(renderer, s_scale, s_scale);
-    QueryPerformanceFrequency(&freq);
+    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888,
+        SDL_TEXTUREACCESS_STREAMING, SCREEN_WIDTH * factor, SCREEN_HEIGHT * factor);
+    if (!texture)
+    {
+        printf("Failed to create texture\n");
+        exit(1);
+    }
 }
 
-#ifndef DISABLE_RENDER
+#ifdef DEBUG_TILES
 static uint16_t tileLineAt(uint16_t addr, uint16_t yOffset)
 {
     uint16_t tile = tileDataSelect ? (uint16_t)vram[addr] * 16
@@ -154,207 +241,322 @@ static uint16_t tileLineAt(uint16_t addr, uint16_t yOffset)
     return vram[pixels] + ((uint16_t)vram[pixels + 1] << 8);
 }
 
-static uint8_t colorIndexAt(uint16_t tileLine, uint8_t x)
+static uint8_t colorAt(uint16_t tileLine, uint8_t x, uint8_t palette)
 {
-    uint8_t l = tileLine & 0xFF;
-    uint8_t h = (tileLine >> 8) & 0xFF;
     uint8_t pixelOffset = 7 - x; // leftmost pixel is 7th bit
-    return ((l >> pixelOffset) & 1) | (((h >> pixelOffset) & 1) << 1);
+    uint8_t colorIndex = ((tileLine >> pixelOffset) & 1) | (((tileLine >> (pixelOffset + 8)) & 1) << 1);
+    return (palette >> (colorIndex * 2)) & 3;
 }
+#endif
 
-static uint8_t colorAt(uint16_t tileLine, uint8_t x, uint8_t palette)
+static void currentRegs(LineRegs *regs)
 {
-    uint8_t colorIndex = colorIndexAt(tileLine, x);
-    uint8_t color = (palette >> (colorIndex * 2)) & 3;
-    return color;
-}
-
-static void renderBg(
-    int colorIndex[NUM_COLORS],
-    SDL_Point colorPoints[NUM_COLORS][WIDTH])
-{
-    uint16_t bgMap = bgTileMapSelect ? 0x1C00 : 0x1800;
-    uint16_t tileMapOffset = bgMap + (((uint8_t)(line + bgScrollY) / 8) * 32);
-    uint16_t tileMapRowEnd = tileMapOffset + 32;
-    uint16_t wrappedLine = line + bgScrollY;
-    if (wrappedLine >= HEIGHT)
-        wrappedLine -= HEIGHT;
-    uint16_t yOffset = (wrappedLine & 7) * 2;
-    uint16_t tileMapIndex = bgScrollX / 8;
-    uint16_t tileMapAddr = tileMapOffset + tileMapIndex;
-    if (tileMapAddr >= tileMapRowEnd)
-        tileMapAddr -= 32;
-    uint16_t tileLine = tileLineAt(tileMapAddr, yOffset);
-    uint8_t x = bgScrollX & 7;
-    for (uint8_t i = 0; i < WIDTH; i++)
-    {
-        uint8_t color = colorAt(tileLine, x, bgPalette);
-        SDL_Point p;
-        p.x = i;
-        p.y = line;
-        colorPoints[color][colorIndex[color]] = p;
-        colorIndex[color]++;
-        x++;
-        if (x == 8)
-        {
-            x = 0;
-            tileMapIndex++;
-            tileMapAddr = tileMapOffset + tileMapIndex;
-            if (tileMapAddr >= tileMapRowEnd)
-                tileMapAddr -= 32;
-            tileLine = tileLineAt(tileMapAddr, yOffset);
-        }
-    }
+    regs->lcdc = lcdControl();
+    regs->scrollX = bgScrollX;
+    regs->scrollY = bgScrollY;
+    regs->windowX = windowScrollX;
+    regs->windowY = windowScrollY;
+    regs->bgPalette = bgPalette;
+    regs->objPalette0 = objPalette0;
+    regs->objPalette1 = objPalette1;
 }
 
-static void renderWindow(
-    int colorIndex[NUM_COLORS],
-    SDL_Point colorPoints[NUM_COLORS][WIDTH])
-{
-    uint16_t windowMap = windowTileMapSelect ? 0x1C00 : 0x1800;
-    uint16_t tileMapOffset = windowMap + ((line / 8) * 32);
-    uint16_t yOffset = (line & 7) * 2;
-    uint16_t tileMapIndex = 0;
-    uint16_t tileMapAddr = tileMapOffset + tileMapIndex;
-    uint16_t tileLine = tileLineAt(tileMapAddr, yOffset);
-    uint8_t x = 0;
-    for (uint8_t i = 0; i < WIDTH; i++)
-    {
-        uint8_t color = colorAt(tileLine, x, bgPalette);
-        SDL_Point p;
-        p.x = i + windowScrollX - 7;
-        p.y = line + windowScrollY;
-        colorPoints[color][colorIndex[color]] = p;
-        colorIndex[color]++;
-        x++;
-        if (x == 8)
-        {
-            x = 0;
-            tileMapIndex++;
-            tileMapAddr = tileMapOffset + tileMapIndex;
-            tileLine = tileLineAt(tileMapAddr, yOffset);
-        }
-    }
+// Brings the FIFO engine up to the current cycle, done before anything it
+// reads changes so mid line writes show up where they happened
+static void runFifo(void)
+{
+    LineRegs regs;
+    currentRegs(&regs);
+    Fifo_run(vram, oam, &regs, clock - Fifo_dots(), fifoLine);
 }
 
-static void renderSprites(
-    int colorIndex[2][NUM_COLORS],
-    SDL_Point colorPoints[2][NUM_COLORS][WIDTH])
+static void startFifoLine(void)
 {
-    if (!spriteDisplayEnable)
-        return;
+    LineRegs regs;
+    currentRegs(&regs);
+    Fifo_startLine(vram, oam, &regs, line);
+}
 
-    for (uint16_t i = 0; i < 0xA0; i += 0x4)
+#ifndef DISABLE_RENDER
+static void startFrameLog(uint8_t resync)
+{
+    // the start state is only read when the renderer didn't see the previous
+    // frame, but copying it is cheap next to drawing
+    frameLog->resync = resync;
+    frameLog->frame = frameNumber;
+    memcpy(frameLog->vram, vram, VRAM_SIZE);
+    memcpy(frameLog->oam, oam, OAM_SIZE);
+    for (uint8_t i = 0; i < SCREEN_HEIGHT; i++)
+        frameLog->lines[i].drawn = 0;
+    frameLog->writeCount = 0;
+    frameLog->overflowed = 0;
+}
+
+static void logWrite(uint16_t addr, uint8_t val)
+{
+    if (!lcdDisplayEnable)
+        return;
+    if (frameLog->writeCount == MAX_FRAME_WRITES)
     {
-        uint8_t spriteY = oam[i] - 16;
-        uint8_t spriteX = oam[i + 1] - 8;
-        uint16_t tile = oam[i + 2] * 16;
-        uint8_t flags = oam[i + 3];
+        frameLog->overflowed = 1;
+        return;
+    }
+    VideoWrite *w = &frameLog->writes[frameLog->writeCount++];
+    w->addr = addr;
+    w->val = val;
+}
 
-        if (line < spriteY || spriteY + 7 < line)
-            continue;
+static void latchLine(void)
+{
+    LineRegs *regs = &frameLog->lines[line];
+    currentRegs(regs);
+    regs->drawn = 1;
+    regs->overflowed = frameLog->overflowed;
+    regs->writes = frameLog->writeCount;
+    regs->composed = engine == PPU_FIFO;
+    if (regs->composed)
+        memcpy(frameLog->pixels[line], fifoLine, SCREEN_WIDTH);
+}
 
-        uint8_t palette = (flags >> 4) & 1 ? objPalette1 : objPalette0;
-        uint8_t flipX = (flags >> 5) & 1;
-        uint8_t flipY = (flags >> 6) & 1;
-        uint8_t priority = (flags >> 7) & 1;
+static void renderFrame(void)
+{
+    if (output == OUTPUT_HIDDEN)
+    {
+        // the renderer resyncs from the next frame it sees
+        frameNumber++;
+        startFrameLog(0);
+        return;
+    }
+    if (frameLog->overflowed)
+    {
+        memcpy(frameLog->endVram, vram, VRAM_SIZE);
+        memcpy(frameLog->endOam, oam, OAM_SIZE);
+    }
+    if (threaded)
+    {
+        // publish the finished log and carry on with whichever one the
+        // render thread isn't holding
+        SDL_MemoryBarrierRelease();
+        backFrame = SDL_AtomicSet(&middleFrame, backFrame | FRAME_READY) & 3;
+        frameLog = &frameLogs[backFrame];
+        SDL_SemPost(frameReady);
+    }
+    else
+    {
+        // a recording wants every frame, not just the ones that reach the
+        // screen
+        uint8_t draw = drawFrame || Recorder_active();
+        Renderer_frame(frameLog, draw);
+        if (draw)
+            Recorder_frame(Renderer_framebuffer(), frameLog->frame);
+    }
+    frameNumber++;
+    startFrameLog(0);
+}
+#endif
 
-        uint8_t y = line - spriteY;
-        uint16_t pixelsAddr = tile + ((flipY ? 7 - y : y) * 2);
-        uint16_t pixels = vram[pixelsAddr] + ((uint16_t)vram[pixelsAddr + 1] << 8);
-        for (uint8_t x = 0; x < 8; x++)
+// Runs on the emulation thread
+static void handleKey(SDL_Event *event)
+{
+    if (event->key.keysym.sym == SDLK_f)
+    {
+        if (event->type == SDL_KEYDOWN && !event->key.repeat)
+            Graphics_setEngine(nextEngine == PPU_FIFO ? PPU_SCANLINE : PPU_FIFO);
+        return;
+    }
+    if (event->key.keysym.sym == SDLK_TAB)
+    {
+        if (event->type == SDL_KEYDOWN && !event->key.repeat)
+            Pacer_setTurbo(!Pacer_turbo());
+        return;
+    }
+    // a movie holds inputs only, going back in time would make its replay
+    // run a different game
+    if (event->key.keysym.sym == SDLK_BACKSPACE || event->key.keysym.sym == SDLK_F8)
+    {
+        if (event->type == SDL_KEYDOWN && !event->key.repeat && Movie_recording())
         {
-            if (!colorIndexAt(pixels, flipX ? 7 - x : x))
-                continue;
-            uint8_t color = colorAt(pixels, flipX ? 7 - x : x, palette);
-            SDL_Point p;
-            p.x = spriteX + x;
-            p.y = spriteY + y;
-            colorPoints[priority][color][colorIndex[priority][color]] = p;
-            colorIndex[priority][color]++;
+            printf("Can't rewind or load a state while recording a movie\n");
+            return;
         }
     }
+    if (event->key.keysym.sym == SDLK_BACKSPACE)
+    {
+        if (!event->key.repeat)
+            Rewind_setActive(event->type == SDL_KEYDOWN);
+        return;
+    }
+    if (event->key.keysym.sym == SDLK_F6)
+    {
+        if (event->type == SDL_KEYDOWN && !event->key.repeat)
+            Cache_mark();
+        return;
+    }
+    if (event->key.keysym.sym == SDLK_F5 || event->key.keysym.sym == SDLK_F8)
+    {
+        if (event->type == SDL_KEYDOWN && !event->key.repeat)
+        {
+            if (event->key.keysym.sym == SDLK_F5)
+                State_requestSave();
+            else
+                State_requestLoad();
+        }
+        return;
+    }
+    Input_pressed(event);
 }
 
-static void renderPoints(uint8_t color, SDL_Point points[], int count)
+static void queueKey(SDL_Event *event)
 {
-    SDL_SetRenderDrawColor(renderer, color, color, color, 255);
-    SDL_RenderDrawPoints(renderer, points, count);
+    uint32_t head = SDL_AtomicGet(&keyHead);
+    if (head - (uint32_t)SDL_AtomicGet(&keyTail) == KEY_QUEUE_SIZE)
+        return;
+    keyQueue[head % KEY_QUEUE_SIZE] = *event;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&keyHead, head + 1);
 }
 
-static void renderScanline(void)
+static void drainKeys(void)
 {
-    int bgIndex[NUM_COLORS] = {0};
-    int windowIndex[NUM_COLORS] = {0};
-    int spriteIndex[2][NUM_COLORS] = {0};
-    SDL_Point bgPoints[NUM_COLORS][WIDTH] = {0};
-    SDL_Point windowPoints[NUM_COLORS][WIDTH] = {0};
-    SDL_Point spritePoints[2][NUM_COLORS][WIDTH] = {0};
-
-    renderBg(bgIndex, bgPoints);
-    if (windowDisplayEnable)
-        renderWindow(windowIndex, windowPoints);
-    renderSprites(spriteIndex, spritePoints);
-
-    uint8_t bgColor0 = bgPalette & 3;
-    renderPoints(s_colors[bgColor0], bgPoints[bgColor0], bgIndex[bgColor0]);
-    for (uint8_t i = 0; i < NUM_COLORS; i++)
-        renderPoints(s_colors[i], spritePoints[1][i], spriteIndex[1][i]);
-    for (uint8_t i = 0; i < NUM_COLORS; i++)
-        if (i != bgColor0)
-            renderPoints(s_colors[i], bgPoints[i], bgIndex[i]);
-    for (uint8_t i = 0; i < NUM_COLORS; i++)
-        renderPoints(s_colors[i], windowPoints[i], windowIndex[i]);
-    for (uint8_t i = 0; i < NUM_COLORS; i++)
-        renderPoints(s_colors[i], spritePoints[0][i], spriteIndex[0][i]);
-#ifdef DEBUG_TILES
-    drawDebugTiles();
-#endif
+    uint32_t tail = SDL_AtomicGet(&keyTail);
+    uint32_t head = SDL_AtomicGet(&keyHead);
+    SDL_MemoryBarrierAcquire();
+    for (; tail != head; tail++)
+        handleKey(&keyQueue[tail % KEY_QUEUE_SIZE]);
+    SDL_AtomicSet(&keyTail, tail);
 }
-#endif
 
-void render(void)
+static void pollEvents(void)
 {
-    SDL_RenderPresent(renderer);
     SDL_Event event;
     while (SDL_PollEvent(&event))
     {
         switch(event.type)
         {
             case SDL_QUIT:
-                exit(0);
+                SDL_AtomicSet(&quitting, 1);
+                break;
             case SDL_KEYDOWN:
+                // the palette belongs to whoever presents, so it never has
+                // to cross over to the emulation thread
+                if (event.key.keysym.sym == SDLK_p)
+                {
+                    if (!event.key.repeat)
+                    {
+                        Palette_next();
+                        paletteChanged = 1;
+                    }
+                    break;
+                }
+                // fall through
             case SDL_KEYUP:
-                Input_pressed(&event);
+                if (threaded)
+                    queueKey(&event);
+                else
+                    handleKey(&event);
                 break;
         }
     }
+}
+
+static void present(void)
+{
+    // upload just the lines that changed, or nothing at all, scaling them and
+    // turning shades into colours on the way
+    uint8_t first, last;
+    uint8_t changed = Renderer_takeChangedLines(&first, &last);
+    if (paletteChanged)
+    {
+        first = 0;
+        last = SCREEN_HEIGHT - 1;
+        changed = 1;
+        paletteChanged = 0;
+    }
+    if (!changed)
+        return;
+    uint8_t border = Scaler_border();
+    first = first > border ? first - border : 0;
+    last = last + border < SCREEN_HEIGHT ? last + border : SCREEN_HEIGHT - 1;
+    uint8_t factor = Scaler_factor();
+    SDL_Rect rect = {
+        0, first * factor, SCREEN_WIDTH * factor, (last - first + 1) * factor
+    };
+    void *pixels;
+    int pitch;
+    if (SDL_LockTexture(texture, &rect, &pixels, &pitch))
+    {
+        printf("Failed to lock texture\n");
+        exit(1);
+    }
+    Scaler_lines(Renderer_framebuffer(), first, last, pixels, pitch);
+    SDL_UnlockTexture(texture);
+    SDL_RenderCopy(renderer, texture, NULL, NULL);
+    SDL_RenderPresent(renderer);
+}
 
-    static LARGE_INTEGER start, end;
-    static uint8_t started = 0;
-    const double msPerFrame = (1000.0 / CLOCK_HZ) * CLOCKS_PER_FRAME;
-    if (started)
+void render(void)
+{
+    if (threaded)
+    {
+        drainKeys();
+        Pacer_frame();
+        return;
+    }
+    // when fast forwarding only some frames are drawn, and only those reach
+    // the screen and poll for input
+#ifdef DEBUG_TILES
+    drawDebugTiles();
+#endif
+    if (drawFrame)
     {
-        QueryPerformanceCounter(&end);
-        double elapsed = (end.QuadPart - start.QuadPart) * 1000.0 / freq.QuadPart;
-        double remaining = msPerFrame - elapsed;
-        if (remaining > 5)
-            SDL_Delay((uint32_t)remaining);
-        QueryPerformanceCounter(&end);
+        present();
+        Pacer_presented();
+        pollEvents();
+    }
+    Pacer_frame();
+    drawFrame = Pacer_presentDue();
+}
+
+// How long the render thread sleeps waiting for a frame before it checks for
+// events again, covers the LCD being off
+#define FRAME_WAIT_MS 16
+
+void Graphics_runThreaded(int (*emulate)(void *))
+{
+    threaded = 1;
+    frameReady = SDL_CreateSemaphore(0);
+    emulation = frameReady ? SDL_CreateThread(emulate, "emulation", NULL) : NULL;
+    if (!emulation)
+    {
+        printf("Failed to start emulation thread\n");
+        exit(1);
+    }
+    while (!SDL_AtomicGet(&quitting))
+    {
+        pollEvents();
+        SDL_SemWaitTimeout(frameReady, FRAME_WAIT_MS);
+#ifndef DISABLE_RENDER
+        if (!(SDL_AtomicGet(&middleFrame) & FRAME_READY))
+            continue;
+        frontFrame = SDL_AtomicSet(&middleFrame, frontFrame) & 3;
+        SDL_MemoryBarrierAcquire();
+        Renderer_frame(&frameLogs[frontFrame], 1);
+        Recorder_frame(Renderer_framebuffer(), frameLogs[frontFrame].frame);
+        present();
+#endif
     }
-    started = 1;
-    QueryPerformanceCounter(&start);
+    SDL_WaitThread(emulation, NULL);
 }
 
-static void step(uint8_t ticks)
+static void step(uint16_t ticks)
 {
     clock += ticks;
     switch (mode)
     {
         case HBLANK:
-            if (clock < 204)
+            if (clock < 376 - mode3Cycles)
                 return;
-            clock = 0;
+            clock -= 376 - mode3Cycles;
             if (line++ < 143)
             {
                 mode = OAM;
@@ -367,6 +569,17 @@ static void step(uint8_t ticks)
             else
             {
                 mode = VBLANK;
+                engine = nextEngine;
+                if (engine == PPU_SCANLINE)
+                    mode3Cycles = MIN_MODE3_CYCLES;
+#ifndef DISABLE_RENDER
+                renderFrame();
+#endif
+                frames++;
+                if (output == OUTPUT_SHOWN)
+                    render();
+                else
+                    held = output == OUTPUT_HELD;
                 INT_PRINT(("graphics requesting vblank interrupt\n"));
                 vblankInterruptRequest = 1;
                 if (vblankInterruptEnable)
@@ -382,7 +595,7 @@ static void step(uint8_t ticks)
         case VBLANK:
             if (clock < 456)
                 return;
-            clock = 0;
+            clock -= 456;
             line++;
             lineCompareFlag = line == lineCompare;
             if (lineCompareInterruptEnable && lineCompareFlag)
@@ -393,6 +606,7 @@ static void step(uint8_t ticks)
             if (line <= 153)
                 return;
             line = 0;
+            Fifo_startFrame();
             lineCompareFlag = line == lineCompare;
             if (lineCompareInterruptEnable && lineCompareFlag)
             {
@@ -405,21 +619,29 @@ static void step(uint8_t ticks)
                 INT_PRINT(("graphics requesting oam status interrupt\n"));
                 statusInterruptRequest = 1;
             }
-            render();
             break;
         case OAM:
             if (clock < 80)
                 return;
-            clock = 0;
+            clock -= 80;
             mode = VRAM;
+            if (engine == PPU_FIFO)
+                startFifoLine();
             break;
         case VRAM:
-            if (clock < 172)
+            if (engine == PPU_FIFO)
+            {
+                runFifo();
+                if (!Fifo_done())
+                    return;
+                mode3Cycles = Fifo_dots();
+            }
+            else if (clock < MIN_MODE3_CYCLES)
                 return;
-            clock = 0;
+            clock -= mode3Cycles;
             mode = HBLANK;
 #ifndef DISABLE_RENDER
-            renderScanline();
+            latchLine();
 #endif
             if (hblankInterruptEnable)
             {
@@ -471,29 +693,79 @@ void drawDebugTiles(void)
         }
         for (uint8_t i = 0; i < NUM_COLORS; i++)
         {
-            uint8_t color = s_colors[i];
-            SDL_SetRenderDrawColor(debug_renderer, color, color, color, 255);
+            uint32_t color = Palette_color(i);
+            SDL_SetRenderDrawColor(debug_renderer, (color >> 16) & 0xFF,
+                (color >> 8) & 0xFF, color & 0xFF, 255);
             SDL_Point *points = colorPoints[i];
             int count = colorIndex[i];
             SDL_RenderDrawPoints(debug_renderer, points, count);
         }
     }
     SDL_SetRenderDrawColor(debug_renderer, 0xAA, 0x33, 0x66, 255);
-    SDL_RenderDrawLine(debug_renderer, bgScrollX, bgScrollY, bgScrollX + WIDTH, bgScrollY);
-    SDL_RenderDrawLine(debug_renderer, bgScrollX + WIDTH, bgScrollY, bgScrollX + WIDTH, bgScrollY + HEIGHT);
-    SDL_RenderDrawLine(debug_renderer, bgScrollX + WIDTH, bgScrollY + HEIGHT, bgScrollX, bgScrollY + HEIGHT);
-    SDL_RenderDrawLine(debug_renderer, bgScrollX, bgScrollY + HEIGHT, bgScrollX, bgScrollY);
+    SDL_RenderDrawLine(debug_renderer, bgScrollX, bgScrollY, bgScrollX + SCREEN_WIDTH, bgScrollY);
+    SDL_RenderDrawLine(debug_renderer, bgScrollX + SCREEN_WIDTH, bgScrollY, bgScrollX + SCREEN_WIDTH, bgScrollY + SCREEN_HEIGHT);
+    SDL_RenderDrawLine(debug_renderer, bgScrollX + SCREEN_WIDTH, bgScrollY + SCREEN_HEIGHT, bgScrollX, bgScrollY + SCREEN_HEIGHT);
+    SDL_RenderDrawLine(debug_renderer, bgScrollX, bgScrollY + SCREEN_HEIGHT, bgScrollX, bgScrollY);
     SDL_RenderPresent(debug_renderer);
 }
 #endif
 
-void Graphics_step(uint8_t ticks)
+void Graphics_step(uint16_t ticks)
 {
     if (lcdDisplayEnable)
         step(ticks);
     GPU_PRINT(("graphics mode %02x line %02x\n", mode, line));
 }
 
+// Length of each mode and where it starts within a line
+static uint16_t modeCycles(Mode mode_)
+{
+    switch (mode_)
+    {
+        case HBLANK:
+            return 376 - mode3Cycles;
+        case VBLANK:
+            return 456;
+        case OAM:
+            return 80;
+        default:
+            return mode3Cycles;
+    }
+}
+
+static uint16_t modeOffset(Mode mode_)
+{
+    switch (mode_)
+    {
+        case HBLANK:
+            return 80 + mode3Cycles;
+        case VRAM:
+            return 80;
+        default:
+            return 0;
+    }
+}
+
+// Frames are presented and paced as vblank starts
+#define VBLANK_LINE 144
+#define LINES 154
+
+uint16_t Graphics_cyclesUntilEvent(void)
+{
+    if (!lcdDisplayEnable)
+        return modeCycles(VBLANK);
+    // how long the FIFO engine takes over a line is only known once it's done
+    if (engine == PPU_FIFO && mode == VRAM)
+        return clock < MIN_MODE3_CYCLES ? MIN_MODE3_CYCLES - clock : 4;
+    return modeCycles(mode) - clock;
+}
+
+uint32_t Graphics_frameCycle(void)
+{
+    uint8_t lineSinceVblank = (line + LINES - VBLANK_LINE) % LINES;
+    return lineSinceVblank * 456 + modeOffset(mode) + clock;
+}
+
 uint8_t Graphics_rb(uint16_t addr)
 {
     uint8_t res = 0;
@@ -505,14 +777,7 @@ uint8_t Graphics_rb(uint16_t addr)
     switch (addr)
     {
         case 0xFF40:
-            res = (lcdDisplayEnable << 7) |
-                  (windowTileMapSelect << 6) |
-                  (windowDisplayEnable << 5) |
-                  (tileDataSelect << 4) |
-                  (bgTileMapSelect << 3) |
-                  (spriteSize << 2) |
-                  (spriteDisplayEnable << 1) |
-                  (bgDisplay);
+            res = lcdControl();
             GPU_PRINT(("gpu read control, val %02x\n", res));
             break;
         case 0xFF41:
@@ -566,14 +831,32 @@ uint8_t Graphics_rb(uint16_t addr)
 
 void Graphics_wb(uint16_t addr, uint8_t val)
 {
+    if (engine == PPU_FIFO && lcdDisplayEnable && mode == VRAM)
+        runFifo();
     if (addr < 0xA000)
+    {
         vram[addr - 0x8000] = val;
+        Snapshot_touch(PAGE_VRAM + ((addr - 0x8000) >> SNAPSHOT_PAGE_SHIFT));
+#ifndef DISABLE_RENDER
+        logWrite(addr - 0x8000, val);
+#endif
+    }
     else if (addr < 0xFEA0)
+    {
         oam[addr - 0xFE00] = val;
+        Snapshot_touch(PAGE_OAM);
+#ifndef DISABLE_RENDER
+        logWrite(addr - 0x8000, val);
+#endif
+    }
 
     switch (addr)
     {
         case 0xFF40:
+#ifndef DISABLE_RENDER
+            if (!lcdDisplayEnable && ((val >> 7) & 1))
+                startFrameLog(1);
+#endif
             lcdDisplayEnable = (val >> 7) & 1;
             windowTileMapSelect = (val >> 6) & 1;
             windowDisplayEnable = (val >> 5) & 1;
@@ -647,5 +930,127 @@ uint8_t Graphics_statusInterrupt(void)
 void Graphics_dma(const uint8_t *dmaAddress)
 {
     GPU_PRINT(("graphics dma copy from address %p", dmaAddress));
-    memcpy(oam, dmaAddress, 0xA0);
+    if (engine == PPU_FIFO && lcdDisplayEnable && mode == VRAM)
+        runFifo();
+    memcpy(oam, dmaAddress, OAM_SIZE);
+    Snapshot_touch(PAGE_OAM);
+#ifndef DISABLE_RENDER
+    for (uint8_t i = 0; i < OAM_SIZE; i++)
+        logWrite(0xFE00 - 0x8000 + i, oam[i]);
+#endif
+}
+
+void Graphics_setEngine(PpuEngine engine_)
+{
+    nextEngine = engine_;
+    Movie_engine(engine_);
+}
+
+// The engine asked for, frames switch over at vblank
+PpuEngine Graphics_engine(void)
+{
+    return nextEngine;
+}
+
+void Graphics_setOutput(GraphicsOutput output_)
+{
+    output = output_;
+}
+
+uint8_t Graphics_quitting(void)
+{
+    return SDL_AtomicGet(&quitting);
+}
+
+// Presents a frame that was held, with the pacing and input that go with it
+void Graphics_present(void)
+{
+    if (held)
+        render();
+    held = 0;
+}
+
+uint32_t Graphics_frames(void)
+{
+    return frames;
+}
+
+uint8_t *Graphics_vram(void)
+{
+    return vram;
+}
+
+uint8_t *Graphics_oam(void)
+{
+    return oam;
+}
+
+void Graphics_saveState(GraphicsState *state)
+{
+    state->clock = clock;
+    state->mode3Cycles = mode3Cycles;
+    state->engine = engine;
+    state->mode = mode;
+    state->line = line;
+    state->lcdc = lcdControl();
+    state->stat = Graphics_rb(0xFF41);
+    state->scrollY = bgScrollY;
+    state->scrollX = bgScrollX;
+    state->lineCompare = lineCompare;
+    state->bgPalette = bgPalette;
+    state->objPalette0 = objPalette0;
+    state->objPalette1 = objPalette1;
+    state->windowY = windowScrollY;
+    state->windowX = windowScrollX;
+    state->vblankInterruptRequest = vblankInterruptRequest;
+    state->statusInterruptRequest = statusInterruptRequest;
+}
+
+// Expects vram and oam to have been restored already
+uint8_t Graphics_checkState(const GraphicsState *state)
+{
+    return state->mode <= VRAM && state->line <= 153 && state->engine <= PPU_FIFO &&
+        state->mode3Cycles >= MIN_MODE3_CYCLES && state->mode3Cycles <= 376;
+}
+
+void Graphics_loadState(const GraphicsState *state)
+{
+    clock = state->clock;
+    mode = state->mode;
+    line = state->line;
+    lcdDisplayEnable = (state->lcdc >> 7) & 1;
+    windowTileMapSelect = (state->lcdc >> 6) & 1;
+    windowDisplayEnable = (state->lcdc >> 5) & 1;
+    tileDataSelect = (state->lcdc >> 4) & 1;
+    bgTileMapSelect = (state->lcdc >> 3) & 1;
+    spriteSize = (state->lcdc >> 2) & 1;
+    spriteDisplayEnable = (state->lcdc >> 1) & 1;
+    bgDisplay = state->lcdc & 1;
+    lineCompareInterruptEnable = (state->stat >> 6) & 1;
+    oamInterruptEnable = (state->stat >> 5) & 1;
+    vblankInterruptEnable = (state->stat >> 4) & 1;
+    hblankInterruptEnable = (state->stat >> 3) & 1;
+    lineCompareFlag = (state->stat >> 2) & 1;
+    bgScrollY = state->scrollY;
+    bgScrollX = state->scrollX;
+    lineCompare = state->lineCompare;
+    bgPalette = state->bgPalette;
+    objPalette0 = state->objPalette0;
+    objPalette1 = state->objPalette1;
+    windowScrollY = state->windowY;
+    windowScrollX = state->windowX;
+    vblankInterruptRequest = state->vblankInterruptRequest;
+    statusInterruptRequest = state->statusInterruptRequest;
+
+    // the engine asked for is a host setting, but the one running the frame
+    // decides its timings, so it carries on to vblank. A line the FIFO engine
+    // is part way through starts over.
+    engine = state->engine;
+    mode3Cycles = state->mode3Cycles;
+    if (engine == PPU_FIFO && mode == VRAM)
+        startFifoLine();
+#ifndef DISABLE_RENDER
+    // the lines so far this frame were drawn from the old state
+    startFrameLog(1);
+#endif
 }
@@ -1,14 +1,58 @@
 #ifndef GRAPHICS_H
 #define GRAPHICS_H
 
+#include "renderer.h"
+
 #include <stdint.h>
 
+typedef enum {
+    PPU_SCANLINE,
+    PPU_FIFO
+} PpuEngine;
+
+typedef enum {
+    OUTPUT_SHOWN,
+    OUTPUT_HIDDEN,
+    OUTPUT_HELD
+} GraphicsOutput;
+
+typedef struct
+{
+    uint16_t clock;
+    uint16_t mode3Cycles;
+    uint8_t engine;
+    uint8_t mode;
+    uint8_t line;
+    uint8_t lcdc;
+    uint8_t stat;
+    uint8_t scrollY, scrollX;
+    uint8_t lineCompare;
+    uint8_t bgPalette, objPalette0, objPalette1;
+    uint8_t windowY, windowX;
+    uint8_t vblankInterruptRequest;
+    uint8_t statusInterruptRequest;
+} GraphicsState;
+
 void Graphics_init(void);
-void Graphics_step(uint8_t ticks);
+void Graphics_runThreaded(int (*emulate)(void *));
+uint8_t Graphics_quitting(void);
+void Graphics_step(uint16_t ticks);
+uint16_t Graphics_cyclesUntilEvent(void);
+uint32_t Graphics_frameCycle(void);
 uint8_t Graphics_rb(uint16_t addr);
 void Graphics_wb(uint16_t addr, uint8_t val);
 uint8_t Graphics_vblankInterrupt(void);
 uint8_t Graphics_statusInterrupt(void);
 void Graphics_dma(const uint8_t *dmaAddress);
+void Graphics_setEngine(PpuEngine engine);
+PpuEngine Graphics_engine(void);
+void Graphics_setOutput(GraphicsOutput output);
+void Graphics_present(void);
+uint32_t Graphics_frames(void);
+uint8_t *Graphics_vram(void);
+uint8_t *Graphics_oam(void);
+void Graphics_saveState(GraphicsState *state);
+uint8_t Graphics_checkState(const GraphicsState *state);
+void Graphics_loadState(const GraphicsState *state);
 
 #endif
@@ -1,6 +1,7 @@
 #include "input.h"
 
 #include "debug.h"
+#include "movie.h"
 
 #include "SDL/SDL.h"
 
@@ -16,7 +17,7 @@ static uint8_t up = 1;
 static uint8_t left = 1;
 static uint8_t right = 1;
 static uint8_t start = 1;
-static uint8_t select = 1;
+static uint8_t selectButton = 1;
 static uint8_t b = 1;
 static uint8_t a = 1;
 
@@ -52,68 +53,101 @@ void Input_pressed(SDL_Event *event)
 {
     uint8_t pressed = event->type == SDL_KEYDOWN;
     SDL_Keycode key = event->key.keysym.sym;
+    uint8_t request = 0;
     if (controlMapping[DOWN] == key)
     {
         down = !pressed;
         if (pressed && directionsSelect)
-            interruptRequest = 1;
+            request = 1;
         INPUT_PRINT(("down pressed %d\n", pressed));
     }
     else if (controlMapping[UP] == key)
     {
         up = !pressed;
         if (pressed && directionsSelect)
-            interruptRequest = 1;
+            request = 1;
         INPUT_PRINT(("up pressed %d\n", pressed));
     }
     else if (controlMapping[LEFT] == key)
     {
         left = !pressed;
         if (pressed && directionsSelect)
-            interruptRequest = 1;
+            request = 1;
         INPUT_PRINT(("left pressed %d\n", pressed));
     }
     else if (controlMapping[RIGHT] == key)
     {
         right = !pressed;
         if (pressed && directionsSelect)
-            interruptRequest = 1;
+            request = 1;
         INPUT_PRINT(("right pressed %d\n", pressed));
     }
     else if (controlMapping[START] == key)
     {
         start = !pressed;
         if (pressed && buttonsSelect)
-            interruptRequest = 1;
+            request = 1;
         INPUT_PRINT(("start pressed %d\n", pressed));
     }
     else if (controlMapping[SELECT] == key)
     {
-        select = !pressed;
+        selectButton = !pressed;
         if (pressed && buttonsSelect)
-            interruptRequest = 1;
+            request = 1;
         INPUT_PRINT(("select pressed %d\n", pressed));
     }
     else if (controlMapping[A] == key)
     {
         a = !pressed;
         if (pressed && buttonsSelect)
-            interruptRequest = 1;
+            request = 1;
         INPUT_PRINT(("a pressed %d\n", pressed));
     }
     else if (controlMapping[B] == key)
     {
         b = !pressed;
         if (pressed && buttonsSelect)
-            interruptRequest = 1;
+            request = 1;
         INPUT_PRINT(("b pressed %d\n", pressed));
     }
+    else
+        return;
+    // repeats change nothing but still request the interrupt, so they're
+    // recorded too
+    interruptRequest |= request;
+    Movie_input(Input_buttons(), request);
+}
+
+uint8_t Input_buttons(void)
+{
+    return !right * BUTTON_RIGHT |
+           !left * BUTTON_LEFT |
+           !up * BUTTON_UP |
+           !down * BUTTON_DOWN |
+           !a * BUTTON_A |
+           !b * BUTTON_B |
+           !selectButton * BUTTON_SELECT |
+           !start * BUTTON_START;
+}
+
+// Stands in for the keyboard when a movie plays back
+void Input_setButtons(uint8_t buttons, uint8_t interrupt)
+{
+    right = !(buttons & BUTTON_RIGHT);
+    left = !(buttons & BUTTON_LEFT);
+    up = !(buttons & BUTTON_UP);
+    down = !(buttons & BUTTON_DOWN);
+    a = !(buttons & BUTTON_A);
+    b = !(buttons & BUTTON_B);
+    selectButton = !(buttons & BUTTON_SELECT);
+    start = !(buttons & BUTTON_START);
+    interruptRequest |= interrupt;
 }
 
 uint8_t Input_read(void)
 {
     uint8_t downOrStart = !directionsSelect ? down : start;
-    uint8_t upOrSelect = !directionsSelect ? up : select;
+    uint8_t upOrSelect = !directionsSelect ? up : selectButton;
     uint8_t leftOrB = !directionsSelect ? left : b;
     uint8_t rightOrA = !directionsSelect ? right : a;
     uint8_t val = (downOrStart) << 3 |
@@ -139,3 +173,33 @@ uint8_t Input_interrupt(void)
     interruptRequest = 0;
     return interrupt;
 }
+
+void Input_saveState(InputState *state)
+{
+    state->buttonsSelect = buttonsSelect;
+    state->directionsSelect = directionsSelect;
+    state->down = down;
+    state->up = up;
+    state->left = left;
+    state->right = right;
+    state->start = start;
+    state->select = selectButton;
+    state->b = b;
+    state->a = a;
+    state->interruptRequest = interruptRequest;
+}
+
+void Input_loadState(const InputState *state)
+{
+    buttonsSelect = state->buttonsSelect;
+    directionsSelect = state->directionsSelect;
+    down = state->down;
+    up = state->up;
+    left = state->left;
+    right = state->right;
+    start = state->start;
+    selectButton = state->select;
+    b = state->b;
+    a = state->a;
+    interruptRequest = state->interruptRequest;
+}
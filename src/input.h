@@ -5,9 +5,33 @@
 
 #include <stdint.h>
 
+// Held buttons as Input_buttons has them, a bit each
+#define BUTTON_RIGHT 0x01
+#define BUTTON_LEFT 0x02
+#define BUTTON_UP 0x04
+#define BUTTON_DOWN 0x08
+#define BUTTON_A 0x10
+#define BUTTON_B 0x20
+#define BUTTON_SELECT 0x40
+#define BUTTON_START 0x80
+
+// Buttons are 0 while held, as the joypad register reads them
+typedef struct
+{
+    uint8_t buttonsSelect;
+    uint8_t directionsSelect;
+    uint8_t down, up, left, right;
+    uint8_t start, select, b, a;
+    uint8_t interruptRequest;
+} InputState;
+
 void Input_pressed(SDL_Event *e);
+uint8_t Input_buttons(void);
+void Input_setButtons(uint8_t buttons, uint8_t interrupt);
 uint8_t Input_read(void);
 void Input_write(uint8_t val);
 uint8_t Input_interrupt(void);
+void Input_saveState(InputState *state);
+void Input_loadState(const InputState *state);
 
 #endif
@@ -0,0 +1,160 @@
+#include "lz.h"
+
+#include <string.h>
+
+// A small byte oriented LZ77 in the style of LZ4. Each sequence is a token
+// holding the literal count in the high nibble and the match length less
+// MIN_MATCH in the low one, either extended by bytes that follow while they
+// are 255, then the literals, a 16 bit match offset and the match. The last
+// sequence is literals only. It is built for speed over ratio, states are
+// mostly runs and repeats and come out small regardless.
+#define MIN_MATCH 4
+#define MAX_OFFSET 0xFFFF
+#define HASH_BITS 12
+// the last few bytes are always literals, so matching never reads past the end
+#define END_LITERALS 8
+
+static uint32_t read32(const uint8_t *p)
+{
+    uint32_t val;
+    memcpy(&val, p, sizeof(val));
+    return val;
+}
+
+static uint32_t hash(uint32_t seq)
+{
+    return (seq * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static uint8_t *writeLength(uint8_t *out, uint32_t length)
+{
+    for (; length >= 255; length -= 255)
+        *out++ = 255;
+    *out++ = length;
+    return out;
+}
+
+static uint8_t *writeSequence(uint8_t *out, const uint8_t *literals, uint32_t literalCount,
+    uint32_t offset, uint32_t matchLength)
+{
+    uint8_t *token = out++;
+    *token = (literalCount < 15 ? literalCount : 15) << 4;
+    if (literalCount >= 15)
+        out = writeLength(out, literalCount - 15);
+    memcpy(out, literals, literalCount);
+    out += literalCount;
+    if (!matchLength)
+        return out;
+    *out++ = offset;
+    *out++ = offset >> 8;
+    matchLength -= MIN_MATCH;
+    *token |= matchLength < 15 ? matchLength : 15;
+    if (matchLength >= 15)
+        out = writeLength(out, matchLength - 15);
+    return out;
+}
+
+// Worst case size of incompressible input
+uint32_t Lz_bound(uint32_t size)
+{
+    return size + size / 255 + 16;
+}
+
+uint32_t Lz_compress(const uint8_t *in, uint32_t size, uint8_t *out)
+{
+    // positions plus one, so zero is empty
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+    uint8_t *start = out;
+    uint32_t anchor = 0;
+    uint32_t pos = 0;
+    uint32_t limit = size > END_LITERALS ? size - END_LITERALS : 0;
+    while (pos < limit)
+    {
+        uint32_t seq = read32(in + pos);
+        uint32_t *slot = &table[hash(seq)];
+        uint32_t ref = *slot - 1;
+        *slot = pos + 1;
+        if (ref >= pos || pos - ref > MAX_OFFSET || read32(in + ref) != seq)
+        {
+            // skip faster through data that isn't matching
+            pos += 1 + ((pos - anchor) >> 6);
+            continue;
+        }
+        uint32_t length = MIN_MATCH;
+        while (pos + length + 8 <= limit)
+        {
+            uint64_t a, b;
+            memcpy(&a, in + pos + length, 8);
+            memcpy(&b, in + ref + length, 8);
+            if (a != b)
+                break;
+            length += 8;
+        }
+        while (pos + length < limit && in[pos + length] == in[ref + length])
+            length++;
+        out = writeSequence(out, in + anchor, pos - anchor, pos - ref, length);
+        pos += length;
+        anchor = pos;
+    }
+    out = writeSequence(out, in + anchor, size - anchor, 0, 0);
+    return out - start;
+}
+
+// Returns the decompressed size, or zero if the input is corrupt or doesn't fit
+uint32_t Lz_decompress(const uint8_t *in, uint32_t size, uint8_t *out, uint32_t capacity)
+{
+    const uint8_t *end = in + size;
+    uint32_t pos = 0;
+    while (in < end)
+    {
+        uint8_t token = *in++;
+        uint32_t literalCount = token >> 4;
+        if (literalCount == 15)
+        {
+            uint8_t byte;
+            do
+            {
+                if (in == end)
+                    return 0;
+                byte = *in++;
+                literalCount += byte;
+            } while (byte == 255);
+        }
+        if (literalCount > (uint32_t)(end - in) || literalCount > capacity - pos)
+            return 0;
+        memcpy(out + pos, in, literalCount);
+        in += literalCount;
+        pos += literalCount;
+        if (in == end)
+            break;
+
+        if (end - in < 2)
+            return 0;
+        uint32_t offset = in[0] | (uint32_t)in[1] << 8;
+        in += 2;
+        uint32_t length = (token & 0xF) + MIN_MATCH;
+        if ((token & 0xF) == 15)
+        {
+            uint8_t byte;
+            do
+            {
+                if (in == end)
+                    return 0;
+                byte = *in++;
+                length += byte;
+            } while (byte == 255);
+        }
+        if (!offset || offset > pos || length > capacity - pos)
+            return 0;
+        // matches may overlap themselves, a run is a match at offset one
+        const uint8_t *ref = out + pos - offset;
+        if (offset >= length)
+            memcpy(out + pos, ref, length);
+        else
+            for (uint32_t i = 0; i < length; i++)
+                out[pos + i] = ref[i];
+        pos += length;
+    }
+    return pos;
+}
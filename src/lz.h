@@ -0,0 +1,10 @@
+#ifndef LZ_H
+#define LZ_H
+
+#include <stdint.h>
+
+uint32_t Lz_bound(uint32_t size);
+uint32_t Lz_compress(const uint8_t *in, uint32_t size, uint8_t *out);
+uint32_t Lz_decompress(const uint8_t *in, uint32_t size, uint8_t *out, uint32_t capacity);
+
+#endif
@@ -0,0 +1,121 @@
+#include "machine.h"
+
+#include "apu.h"
+#include "autosave.h"
+#include "cache.h"
+#include "cpu.h"
+#include "graphics.h"
+#include "movie.h"
+#include "pacer.h"
+#include "rewind.h"
+#include "snapshot.h"
+#include "state.h"
+#include "timer.h"
+
+#define CLOCKS_PER_FRAME 70224
+
+// Cycles emulated since power on
+static uint64_t cycles = 0;
+
+// Frames run ahead of the one shown
+static uint8_t runAhead = 0;
+static Snapshot runAheadSnapshot;
+
+void Machine_tick(uint16_t ticks)
+{
+    cycles += ticks;
+    Graphics_step(ticks);
+    Timer_step(ticks);
+    Apu_step(ticks);
+    Movie_tick(cycles);
+}
+
+// While halted nothing happens until the next ppu mode change or timer
+// overflow, so jump straight there and give the host the time back
+static void idle(void)
+{
+    uint16_t cycles = Graphics_cyclesUntilEvent();
+    uint16_t timerCycles = Timer_cyclesUntilEvent();
+    if (timerCycles < cycles)
+        cycles = timerCycles;
+    // running ahead fits several frames into one, there's no time to give
+    if (!runAhead)
+        Pacer_idle(Graphics_frameCycle() + cycles);
+    Machine_tick(cycles);
+}
+
+void Machine_step(void)
+{
+    if (Cpu_halted())
+        idle();
+    else
+        Machine_tick(Cpu_step());
+    Cpu_interrupts();
+}
+
+// Runs until the ppu enters vblank, or for a frame's worth of cycles while
+// the lcd is off
+static void runFrame(void)
+{
+    uint32_t frame = Graphics_frames();
+    uint64_t end = cycles + CLOCKS_PER_FRAME;
+    while (Graphics_frames() == frame && cycles < end)
+        Machine_step();
+}
+
+// The frame shown is the one runAhead frames on, run with the input as it is
+// now, so a press shows up that many frames sooner. The machine itself only
+// moves a frame, the rest is thrown away.
+static void runAheadFrame(void)
+{
+    Graphics_setOutput(OUTPUT_HIDDEN);
+    runFrame();
+    Snapshot_take(&runAheadSnapshot);
+    Apu_setSpeculative(1);
+    for (uint8_t i = 1; i < runAhead; i++)
+        runFrame();
+    Graphics_setOutput(OUTPUT_HELD);
+    runFrame();
+    Apu_setSpeculative(0);
+    Snapshot_restore(&runAheadSnapshot);
+    Graphics_setOutput(OUTPUT_SHOWN);
+    // input is taken here, after the restore, so none is lost
+    Movie_setBetweenFrames(1);
+    Graphics_present();
+    Movie_setBetweenFrames(0);
+}
+
+// Between frames is where states are saved and loaded
+void Machine_frame(void)
+{
+    if (runAhead)
+        runAheadFrame();
+    else
+        runFrame();
+    Movie_frame();
+    State_frame();
+    Cache_frame();
+    Autosave_frame();
+    Rewind_frame();
+}
+
+void Machine_setRunAhead(uint8_t frames)
+{
+    runAhead = frames;
+    Snapshot_init(&runAheadSnapshot);
+}
+
+uint64_t Machine_cycles(void)
+{
+    return cycles;
+}
+
+void Machine_saveState(MachineState *state)
+{
+    state->cycles = cycles;
+}
+
+void Machine_loadState(const MachineState *state)
+{
+    cycles = state->cycles;
+}
@@ -0,0 +1,19 @@
+#ifndef MACHINE_H
+#define MACHINE_H
+
+#include <stdint.h>
+
+typedef struct
+{
+    uint64_t cycles;
+} MachineState;
+
+void Machine_tick(uint16_t ticks);
+void Machine_step(void);
+void Machine_frame(void);
+void Machine_setRunAhead(uint8_t frames);
+uint64_t Machine_cycles(void);
+void Machine_saveState(MachineState *state);
+void Machine_loadState(const MachineState *state);
+
+#endif
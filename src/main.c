@@ -1,33 +1,257 @@
+#include "apu.h"
+#include "audio.h"
+#include "autosave.h"
+#include "cache.h"
 #include "cartridge.h"
 #include "cpu.h"
 #include "graphics.h"
+#include "machine.h"
 #include "memory.h"
-#include "timer.h"
+#include "movie.h"
+#include "pacer.h"
+#include "palette.h"
+#include "recorder.h"
+#include "rewind.h"
+#include "scaler.h"
+#include "state.h"
+#include "wav.h"
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_RATE 48000
 
 uint8_t enableDebugPrints = 1;
 
+static void usage(const char *name)
+{
+    printf("\nUsage: %s [options] <rom file>\n\n", name);
+    printf("  --vsync           lock frame pacing to the display refresh\n");
+    printf("  --audio-sync      lock frame pacing to audio playback\n");
+    printf("  --no-audio        don't open an audio device\n");
+    printf("  --turbo <n>       fast forward speed toggled with tab, up to 16,\n");
+    printf("                    0 is uncapped\n");
+    printf("  --frameskip <n>   skip up to n frames in a row when running behind,\n");
+    printf("                    0 to 10\n");
+    printf("  --render-thread   compose and present frames on a separate thread\n");
+    printf("  --palette <p>     gray, dmg, pocket or four RRGGBB colours separated by\n");
+    printf("                    commas, lightest first, p cycles through them\n");
+    printf("  --scale <n>       window scale for the nearest filter, 1 to 8\n");
+    printf("  --filter <f>      nearest, scale2x or scale3x\n");
+    printf("  --ppu <engine>    scanline (default) or fifo for mid line effects,\n");
+    printf("                    f switches while running\n");
+    printf("  --record <file>   record every frame to a .y4m or raw rgb24 file\n");
+    printf("                    with an index of frame hashes alongside\n");
+    printf("  --wav <file>      capture all audio to a wav file, at a fixed rate\n");
+    printf("                    whatever the speed or audio device\n");
+    printf("  --load-state <f>  start from a save state, f5 saves and f8 loads\n");
+    printf("                    <rom>.state while running\n");
+    printf("  --autosave <s>    write the state every s seconds in the background,\n");
+    printf("                    rotating through <rom>.auto1.state to auto3\n");
+    printf("  --warm-start <n>  resume from a state cached n frames into the first\n");
+    printf("                    run, or at f6 if n is 0\n");
+    printf("  --run-ahead <n>   show frames n ahead to cut input lag, 1 to 4\n");
+    printf("  --rewind <mb>     keep mb megabytes of past frames, hold backspace\n");
+    printf("                    to rewind through them\n");
+    printf("  --movie <file>    record every joypad change to a movie file\n");
+    printf("  --checkpoints     hash the machine into the movie every frame\n");
+    printf("  --replay <file>   play a movie back with no window or sound as fast\n");
+    printf("                    as possible, checking any checkpoints\n\n");
+}
+
+static int emulate(void *data)
+{
+    (void)data;
+    while (!Graphics_quitting())
+        Machine_frame();
+    return 0;
+}
+
 int main(int argc, char **argv)
 {
-    if (argc != 2)
+    const char *romFile = NULL;
+    PacerMode pacerMode = PACER_TIMED;
+    uint8_t renderThread = 0;
+    uint8_t audio = 1;
+    const char *recordFile = NULL;
+    const char *wavFile = NULL;
+    const char *stateFile = NULL;
+    int rewindBudget = 0;
+    int runAhead = 0;
+    int warmStart = -1;
+    int autosave = 0;
+    const char *movieFile = NULL;
+    const char *playFile = NULL;
+    uint8_t checkpoints = 0;
+    for (int i = 1; i < argc; i++)
     {
-        printf("\nUsage: %s <rom file>\n\n", argv[0]);
+        if (!strcmp(argv[i], "--vsync"))
+            pacerMode = PACER_VSYNC;
+        else if (!strcmp(argv[i], "--audio-sync"))
+            pacerMode = PACER_AUDIO;
+        else if (!strcmp(argv[i], "--no-audio"))
+            audio = 0;
+        else if (!strcmp(argv[i], "--turbo") && i + 1 < argc)
+        {
+            int speed = atoi(argv[++i]);
+            if (speed < 0 || speed > 16)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            Pacer_setTurboSpeed(speed);
+        }
+        else if (!strcmp(argv[i], "--frameskip") && i + 1 < argc)
+        {
+            int frames = atoi(argv[++i]);
+            if (frames < 0 || frames > 10)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            Pacer_setMaxFrameSkip(frames);
+        }
+        else if (!strcmp(argv[i], "--render-thread"))
+            renderThread = 1;
+        else if (!strcmp(argv[i], "--palette") && i + 1 < argc)
+        {
+            if (!Palette_set(argv[++i]))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--scale") && i + 1 < argc)
+        {
+            if (!Scaler_setScale(atoi(argv[++i])))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+        {
+            if (!Scaler_setFilter(argv[++i]))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--record") && i + 1 < argc)
+            recordFile = argv[++i];
+        else if (!strcmp(argv[i], "--wav") && i + 1 < argc)
+            wavFile = argv[++i];
+        else if (!strcmp(argv[i], "--load-state") && i + 1 < argc)
+            stateFile = argv[++i];
+        else if (!strcmp(argv[i], "--autosave") && i + 1 < argc)
+        {
+            autosave = atoi(argv[++i]);
+            if (autosave <= 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--warm-start") && i + 1 < argc)
+        {
+            warmStart = atoi(argv[++i]);
+            if (warmStart < 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--run-ahead") && i + 1 < argc)
+        {
+            runAhead = atoi(argv[++i]);
+            if (runAhead < 1 || runAhead > 4)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--movie") && i + 1 < argc)
+            movieFile = argv[++i];
+        else if (!strcmp(argv[i], "--checkpoints"))
+            checkpoints = 1;
+        else if (!strcmp(argv[i], "--replay") && i + 1 < argc)
+            playFile = argv[++i];
+        else if (!strcmp(argv[i], "--rewind") && i + 1 < argc)
+        {
+            rewindBudget = atoi(argv[++i]);
+            if (rewindBudget <= 0 || rewindBudget > 2048)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (!strcmp(argv[i], "--ppu") && i + 1 < argc)
+        {
+            i++;
+            if (!strcmp(argv[i], "fifo"))
+                Graphics_setEngine(PPU_FIFO);
+            else if (strcmp(argv[i], "scanline"))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+        }
+        else if (argv[i][0] != '-' && !romFile)
+            romFile = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (!romFile)
+    {
+        usage(argv[0]);
         return 1;
     }
 
     Cpu_init();
-    Cartridge_load(argv[1]);
+    Cartridge_load(romFile);
+    State_init(romFile);
+    State_setLoader(Autosave_read);
+    Pacer_init(pacerMode);
+    Apu_init(SAMPLE_RATE);
+    if (wavFile)
+        Wav_start(wavFile, SAMPLE_RATE);
+    if (playFile)
+    {
+        // no window or sound, and as fast as it goes
+        Pacer_setTurboSpeed(0);
+        Pacer_setTurbo(1);
+        Graphics_setOutput(OUTPUT_HIDDEN);
+        Memory_init();
+        Movie_play(playFile);
+        emulate(NULL);
+    }
+    if (audio && Audio_init(SAMPLE_RATE, wavFile != NULL) && pacerMode == PACER_AUDIO)
+        Pacer_setAudioWait(Audio_wait);
     Graphics_init();
+    if (recordFile)
+        Recorder_start(recordFile);
     Memory_init();
+    if (stateFile && !State_load(stateFile))
+        exit(1);
+    if (warmStart >= 0 && !stateFile)
+        Cache_start(romFile, warmStart);
+    if (rewindBudget)
+        Rewind_init((uint32_t)rewindBudget << 20);
+    if (autosave)
+        Autosave_start(romFile, autosave);
+    if (runAhead)
+        Machine_setRunAhead(runAhead);
+    if (movieFile)
+        Movie_record(movieFile, checkpoints);
 
-    while (1)
-    {
-        uint8_t ticks = Cpu_step();
-        Graphics_step(ticks);
-        Timer_step(ticks);
-        Cpu_interrupts();
-    }
+    if (renderThread)
+        Graphics_runThreaded(emulate);
+    else
+        emulate(NULL);
+    return 0;
 }
-
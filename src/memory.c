@@ -1,14 +1,17 @@
 #include "memory.h"
 
+#include "apu.h"
 #include "cartridge.h"
 #include "debug.h"
 #include "graphics.h"
 #include "input.h"
+#include "snapshot.h"
 #include "timer.h"
 
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #define RAM_SIZE 1 << 16
 static uint8_t ram[RAM_SIZE];
@@ -117,20 +120,10 @@ uint8_t Mem_rb(uint16_t addr)
         val = interruptFlag;
         MEM_READ("interrupt flag", addr, val);
     }
-    else if (addr == 0xFF24)
+    else if (0xFF10 <= addr && addr <= 0xFF3F)
     {
-        val = ram[addr];
-        MEM_READ("volume control", addr, val);
-    }
-    else if (addr == 0xFF25)
-    {
-        val = ram[addr];
-        MEM_READ("sound output select", addr, val);
-    }
-    else if (addr == 0xFF26)
-    {
-        val = ram[addr];
-        MEM_READ("sound enable", addr, val);
+        val = Apu_rb(addr);
+        MEM_READ("sound", addr, val);
     }
     else if ((0xFF40 <= addr && addr <= 0xFF45) || (0xFF47 <= addr && addr <= 0xFF49) ||
         addr == 0xFF4A || addr == 0xFF4B)
@@ -201,11 +194,13 @@ void Mem_wb(uint16_t addr, uint8_t val)
     else if (addr < 0xE000)
     {
         ram[addr] = val;
+        Snapshot_touch(PAGE_WORK_RAM + ((addr - 0xC000) >> SNAPSHOT_PAGE_SHIFT));
         MEM_WRITE("working ram", addr, val);
     }
     else if (addr < 0xFE00)
     {
         ram[addr - 0x2000] = val;
+        Snapshot_touch(PAGE_WORK_RAM + ((addr - 0xE000) >> SNAPSHOT_PAGE_SHIFT));
         MEM_WRITE("working ram echo", addr, val);
     }
     else if (addr < 0xFEA0)
@@ -225,6 +220,7 @@ void Mem_wb(uint16_t addr, uint8_t val)
     else if (0xFF01 <= addr && addr <= 0xFF02)
     {
         ram[addr] = val;
+        Snapshot_touch(PAGE_HIGH_RAM);
         MEM_WRITE("serial ports", addr, val);
     }
     else if (0xFF04 <= addr && addr <= 0xFF07)
@@ -238,20 +234,10 @@ void Mem_wb(uint16_t addr, uint8_t val)
         MEM_WRITE("interrupt flag", addr, val);
         INT_PRINT(("interrupt flag written, val %02x\n", val));
     }
-    else if (addr == 0xFF24)
-    {
-        ram[addr] = val;
-        MEM_WRITE("volume control", addr, val);
-    }
-    else if (addr == 0xFF25)
-    {
-        ram[addr] = val;
-        MEM_WRITE("sound output select", addr, val);
-    }
-    else if (addr == 0xFF26)
+    else if (0xFF10 <= addr && addr <= 0xFF3F)
     {
-        ram[addr] = val;
-        MEM_WRITE("sound enable", addr, val);
+        Apu_wb(addr, val);
+        MEM_WRITE("sound", addr, val);
     }
     else if ((0xFF40 <= addr && addr <= 0xFF45) || (0xFF47 <= addr && addr <= 0xFF49) ||
         addr == 0xFF4A || addr == 0xFF4B)
@@ -290,11 +276,13 @@ void Mem_wb(uint16_t addr, uint8_t val)
     else if (addr < 0xFF80)
     {
         ram[addr] = val;
+        Snapshot_touch(PAGE_HIGH_RAM);
         MEM_WRITE("unknown io port", addr, val);
     }
     else if (addr < 0xFFFF)
     {
         ram[addr] = val;
+        Snapshot_touch(PAGE_HIGH_RAM);
         MEM_WRITE("high ram", addr, val);
     }
     else if (addr == 0xFFFF)
@@ -309,3 +297,28 @@ void Mem_ww(uint16_t addr, uint16_t val)
     Mem_wb(addr, val & 255);
     Mem_wb(addr + 1, val >> 8);
 }
+
+// FF00-FFFF holds the io ports kept in memory as well as high ram
+uint8_t *Memory_workRam(void)
+{
+    return &ram[0xC000];
+}
+
+uint8_t *Memory_highRam(void)
+{
+    return &ram[0xFF00];
+}
+
+void Memory_saveState(MemoryState *state)
+{
+    state->interruptFlag = interruptFlag;
+    state->interruptEnable = interruptEnable;
+    state->inBootRom = inBootRom;
+}
+
+void Memory_loadState(const MemoryState *state)
+{
+    interruptFlag = state->interruptFlag;
+    interruptEnable = state->interruptEnable;
+    inBootRom = state->inBootRom;
+}
@@ -3,10 +3,24 @@
 
 #include <stdint.h>
 
+#define WORK_RAM_SIZE 0x2000
+#define HIGH_RAM_SIZE 0x100
+
+typedef struct
+{
+    uint8_t interruptFlag;
+    uint8_t interruptEnable;
+    uint8_t inBootRom;
+} MemoryState;
+
 void Memory_init(void);
 uint8_t Mem_rb(uint16_t addr);
 uint16_t Mem_rw(uint16_t addr);
 void Mem_wb(uint16_t addr, uint8_t val);
 void Mem_ww(uint16_t addr, uint16_t val);
+uint8_t *Memory_workRam(void);
+uint8_t *Memory_highRam(void);
+void Memory_saveState(MemoryState *state);
+void Memory_loadState(const MemoryState *state);
 
 #endif
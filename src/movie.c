@@ -0,0 +1,279 @@
+#include "movie.h"
+
+#include "cartridge.h"
+#include "file.h"
+#include "graphics.h"
+#include "input.h"
+#include "machine.h"
+#include "state.h"
+
+#include "SDL/SDL.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A movie is a header, the state it starts from, then events in emulated
+// time. The header holds the magic, version, size of the state, hash of the
+// rom and the cycle the movie starts on. Each event is the cycles since the
+// one before as a LEB128 varint and a type byte. Inputs are followed by the
+// buttons held after the change, engine switches by the engine and
+// checkpoints by a hash of the machine at the end of a frame.
+#define MOVIE_MAGIC "GBMOVIE"
+#define MOVIE_VERSION 1
+#define HEADER_SIZE 32
+
+#define EVENT_INPUT 0
+#define EVENT_ENGINE 1
+#define EVENT_CHECKPOINT 2
+#define EVENT_END 3
+#define EVENT_KIND 0x0F
+// Inputs and engine switches are applied at the end of the tick reaching
+// their cycle, unless they were taken between frames as running ahead does
+#define EVENT_BETWEEN_FRAMES 0x10
+// the press requested the joypad interrupt
+#define EVENT_INTERRUPT 0x20
+
+uint64_t movieNextInput = UINT64_MAX;
+
+static uint8_t recording = 0;
+static uint8_t playing = 0;
+static uint8_t checkpoints = 0;
+static uint8_t betweenFrames = 0;
+static uint64_t lastCycles = 0;
+static uint8_t *image = NULL;
+
+// Recording
+static FILE *file = NULL;
+
+// Playback
+static uint8_t *movie = NULL;
+static uint32_t movieSize = 0;
+static uint32_t pos = 0;
+static uint8_t nextType = EVENT_END;
+static uint64_t nextCycles = 0;
+static uint32_t frames = 0;
+static uint32_t checked = 0;
+static uint64_t startTime = 0;
+
+// Hashes the whole state a word at a time, it's run every frame
+static uint64_t stateHash(void)
+{
+    uint32_t size = State_size();
+    State_write(image);
+    uint64_t hash = 1469598103934665603ULL;
+    for (uint32_t i = 0; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, image + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static void writeEvent(uint8_t type, const uint8_t *data, uint8_t size)
+{
+    uint64_t cycles = Machine_cycles();
+    uint64_t delta = cycles - lastCycles;
+    lastCycles = cycles;
+    uint8_t event[10 + 1 + 8];
+    uint8_t length = 0;
+    do
+    {
+        event[length++] = (delta & 0x7F) | (delta > 0x7F ? 0x80 : 0);
+        delta >>= 7;
+    } while (delta);
+    event[length++] = type;
+    if (size)
+        memcpy(event + length, data, size);
+    fwrite(event, 1, length + size, file);
+}
+
+// Reads the next event's time and type, a truncated movie just ends
+static void readEvent(void)
+{
+    uint64_t delta = 0;
+    uint8_t shift = 0;
+    uint8_t byte = 0x80;
+    while (pos < movieSize && (byte & 0x80) && shift < 64)
+    {
+        byte = movie[pos++];
+        delta |= (uint64_t)(byte & 0x7F) << shift;
+        shift += 7;
+    }
+    nextType = pos < movieSize ? movie[pos++] : EVENT_END;
+    uint8_t kind = nextType & EVENT_KIND;
+    uint8_t size = kind == EVENT_CHECKPOINT ? 8 : kind == EVENT_END ? 0 : 1;
+    if (kind > EVENT_END || movieSize - pos < size)
+        nextType = kind = EVENT_END;
+    nextCycles += delta;
+    movieNextInput = kind <= EVENT_ENGINE && !(nextType & EVENT_BETWEEN_FRAMES) ? nextCycles : UINT64_MAX;
+}
+
+static void applyInput(void)
+{
+    if ((nextType & EVENT_KIND) == EVENT_ENGINE)
+        Graphics_setEngine(movie[pos++]);
+    else
+        Input_setButtons(movie[pos++], !!(nextType & EVENT_INTERRUPT));
+    readEvent();
+}
+
+static void finish(void)
+{
+    double seconds = (double)(SDL_GetPerformanceCounter() - startTime) / SDL_GetPerformanceFrequency();
+    double emulated = (double)(Machine_cycles() - File_get64(movie + 24)) / 4194304;
+    printf("replayed %u frames in %.2fs, %.1fx speed, %u checkpoints matched\n",
+        frames, seconds, seconds > 0 ? emulated / seconds : 0, checked);
+    exit(0);
+}
+
+// Records from here on, starting from the state the machine is in now
+void Movie_record(const char *path, uint8_t checkpoints_)
+{
+    file = fopen(path, "wb");
+    image = malloc(State_size());
+    if (!file || !image)
+    {
+        printf("Failed to open movie file %s\n", path);
+        exit(1);
+    }
+    uint8_t header[HEADER_SIZE];
+    memcpy(header, MOVIE_MAGIC, 8);
+    File_put32(header + 8, MOVIE_VERSION);
+    File_put32(header + 12, State_size());
+    File_put64(header + 16, Cartridge_hash());
+    File_put64(header + 24, Machine_cycles());
+    fwrite(header, 1, HEADER_SIZE, file);
+    State_write(image);
+    fwrite(image, 1, State_size(), file);
+    lastCycles = Machine_cycles();
+    checkpoints = checkpoints_;
+    recording = 1;
+    Movie_engine(Graphics_engine());
+    atexit(Movie_stop);
+}
+
+// Loads the movie's state and plays its inputs back, stopping the emulator
+// at the end
+void Movie_play(const char *path)
+{
+    FILE *in = fopen(path, "rb");
+    if (in)
+    {
+        fseek(in, 0, SEEK_END);
+        movieSize = ftell(in);
+        fseek(in, 0, SEEK_SET);
+        movie = malloc(movieSize);
+        if (movie && fread(movie, 1, movieSize, in) != movieSize)
+            movieSize = 0;
+        fclose(in);
+    }
+    uint32_t stateSize = movieSize >= HEADER_SIZE ? File_get32(movie + 12) : 0;
+    if (!in || !movie || movieSize < HEADER_SIZE || memcmp(movie, MOVIE_MAGIC, 8) ||
+        File_get32(movie + 8) != MOVIE_VERSION || movieSize - HEADER_SIZE < stateSize)
+    {
+        printf("Failed to read movie %s\n", path);
+        exit(1);
+    }
+    if (File_get64(movie + 16) != Cartridge_hash())
+    {
+        printf("Movie %s was recorded with another rom\n", path);
+        exit(1);
+    }
+    if (!State_read(movie + HEADER_SIZE, stateSize))
+        exit(1);
+    image = malloc(State_size());
+    if (!image)
+        exit(1);
+    pos = HEADER_SIZE + stateSize;
+    nextCycles = Machine_cycles();
+    readEvent();
+    playing = 1;
+    startTime = SDL_GetPerformanceCounter();
+}
+
+uint8_t Movie_recording(void)
+{
+    return recording;
+}
+
+uint8_t Movie_playing(void)
+{
+    return playing;
+}
+
+// Every change from the keyboard, as Input_pressed makes it
+void Movie_input(uint8_t buttons, uint8_t interrupt)
+{
+    if (!recording)
+        return;
+    uint8_t type = EVENT_INPUT | (betweenFrames ? EVENT_BETWEEN_FRAMES : 0) |
+        (interrupt ? EVENT_INTERRUPT : 0);
+    writeEvent(type, &buttons, 1);
+}
+
+// The engine changes timings, so switches are played back too
+void Movie_engine(uint8_t engine)
+{
+    if (!recording)
+        return;
+    uint8_t type = EVENT_ENGINE | (betweenFrames ? EVENT_BETWEEN_FRAMES : 0);
+    writeEvent(type, &engine, 1);
+}
+
+void Movie_setBetweenFrames(uint8_t between)
+{
+    betweenFrames = between;
+}
+
+void Movie_applyInputs(void)
+{
+    uint64_t cycles = Machine_cycles();
+    while ((nextType & EVENT_KIND) <= EVENT_ENGINE && !(nextType & EVENT_BETWEEN_FRAMES) &&
+        nextCycles <= cycles)
+        applyInput();
+}
+
+// Checkpoints are taken and inputs from between frames land here
+void Movie_frame(void)
+{
+    if (recording && checkpoints)
+    {
+        uint8_t hash[8];
+        File_put64(hash, stateHash());
+        writeEvent(EVENT_CHECKPOINT, hash, 8);
+    }
+    if (!playing)
+        return;
+    frames++;
+    uint64_t cycles = Machine_cycles();
+    while (nextType != EVENT_END && nextCycles <= cycles)
+    {
+        if ((nextType & EVENT_KIND) == EVENT_CHECKPOINT)
+        {
+            if (nextCycles != cycles || File_get64(movie + pos) != stateHash())
+            {
+                printf("replay diverged at frame %u, cycle %" PRIu64 "\n", frames, cycles);
+                exit(1);
+            }
+            pos += 8;
+            checked++;
+            readEvent();
+        }
+        else
+            applyInput();
+    }
+    if (nextType == EVENT_END && nextCycles <= cycles)
+        finish();
+}
+
+void Movie_stop(void)
+{
+    if (!recording)
+        return;
+    recording = 0;
+    writeEvent(EVENT_END, NULL, 0);
+    fclose(file);
+}
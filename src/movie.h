@@ -0,0 +1,27 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stdint.h>
+
+// The cycle the next input in a movie being played lands on
+extern uint64_t movieNextInput;
+
+void Movie_record(const char *path, uint8_t checkpoints);
+void Movie_play(const char *path);
+uint8_t Movie_recording(void);
+uint8_t Movie_playing(void);
+void Movie_input(uint8_t buttons, uint8_t interrupt);
+void Movie_engine(uint8_t engine);
+void Movie_setBetweenFrames(uint8_t between);
+void Movie_applyInputs(void);
+void Movie_frame(void);
+void Movie_stop(void);
+
+// Called at the end of every tick, where live input lands too
+static inline void Movie_tick(uint64_t cycles)
+{
+    if (cycles >= movieNextInput)
+        Movie_applyInputs();
+}
+
+#endif
@@ -0,0 +1,239 @@
+#include "pacer.h"
+
+#include "debug.h"
+
+#include "SDL/SDL.h"
+
+#define CLOCK_HZ 4194304
+#define CLOCKS_PER_FRAME 70224
+
+// SDL_Delay is only good to about a millisecond, spin for the last stretch
+#define SPIN_MS 2
+
+// Halted stretches that end closer than this aren't worth a trip through the
+// scheduler
+#define IDLE_MIN_MS 2
+
+// Further behind than this (window drag, debugger) and we resync instead of
+// racing through the backlog
+#define MAX_LAG_FRAMES 4
+
+static PacerMode mode = PACER_TIMED;
+static void (*audioWait)(void) = NULL;
+
+// Emulated speed as a multiple of real time, 0 is uncapped
+static uint8_t speed = 1;
+static uint8_t turboSpeed = 0;
+static uint8_t turbo = 0;
+
+// Performance counter ticks per emulated frame at the current speed, kept as
+// whole + remainder so the deadline never drifts from 59.73 Hz * speed
+static uint64_t freq = 0;
+static uint64_t realPeriod = 0;
+static uint64_t periodWhole = 0;
+static uint64_t periodRem = 0;
+static uint64_t periodDiv = 0;
+static uint64_t remAccum = 0;
+static uint64_t deadline = 0;
+
+// Fast-forward bookkeeping for deciding which frames reach the screen
+static uint32_t frameCount = 0;
+static uint64_t lastPresent = 0;
+
+// Adaptive frame skip, 0 disables
+#define REPORT_FRAMES 600
+static uint8_t maxSkip = 0;
+static uint8_t consecutiveSkips = 0;
+static uint32_t skippedFrames = 0;
+static uint32_t reportSkipped = 0;
+static uint64_t reportHostTime = 0;
+static uint64_t workStart = 0;
+
+void Pacer_init(PacerMode mode_)
+{
+    mode = mode_;
+    freq = SDL_GetPerformanceFrequency();
+    realPeriod = freq * CLOCKS_PER_FRAME / CLOCK_HZ;
+    Pacer_setTurbo(turbo);
+}
+
+PacerMode Pacer_mode(void)
+{
+    return mode;
+}
+
+void Pacer_setAudioWait(void (*wait)(void))
+{
+    audioWait = wait;
+}
+
+void Pacer_setTurboSpeed(uint8_t speed_)
+{
+    turboSpeed = speed_;
+    if (turbo)
+        Pacer_setTurbo(turbo);
+}
+
+void Pacer_setTurbo(uint8_t enable)
+{
+    turbo = enable;
+    speed = turbo ? turboSpeed : 1;
+    uint64_t divisor = speed ? speed : 1;
+    periodDiv = (uint64_t)CLOCK_HZ * divisor;
+    periodWhole = freq * CLOCKS_PER_FRAME / periodDiv;
+    periodRem = freq * CLOCKS_PER_FRAME % periodDiv;
+    remAccum = 0;
+    deadline = SDL_GetPerformanceCounter();
+    frameCount = 0;
+}
+
+uint8_t Pacer_turbo(void)
+{
+    return turbo;
+}
+
+uint8_t Pacer_speed(void)
+{
+    return speed;
+}
+
+void Pacer_setMaxFrameSkip(uint8_t frames)
+{
+    maxSkip = frames;
+}
+
+uint32_t Pacer_skippedFrames(void)
+{
+    return skippedFrames;
+}
+
+// Skip drawing while more than half a frame behind real time, the emulated
+// frame still runs in full so only the picture is decimated
+static uint8_t skipDue(void)
+{
+    if (!maxSkip || mode != PACER_TIMED || consecutiveSkips >= maxSkip ||
+        SDL_GetPerformanceCounter() <= deadline + periodWhole / 2)
+    {
+        consecutiveSkips = 0;
+        return 0;
+    }
+    consecutiveSkips++;
+    skippedFrames++;
+    reportSkipped++;
+    return 1;
+}
+
+uint8_t Pacer_presentDue(void)
+{
+    if (speed == 1)
+        return !skipDue();
+    if (speed)
+        return frameCount % speed == 0;
+    // uncapped, show whatever frame is current once per real frame
+    return SDL_GetPerformanceCounter() - lastPresent >= realPeriod;
+}
+
+void Pacer_presented(void)
+{
+    lastPresent = SDL_GetPerformanceCounter();
+}
+
+static void waitUntil(uint64_t target)
+{
+    uint64_t spin = freq * SPIN_MS / 1000;
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (target > now + spin)
+        SDL_Delay((uint32_t)((target - now - spin) * 1000 / freq));
+    while (SDL_GetPerformanceCounter() < target)
+        ;
+}
+
+void Pacer_idle(uint32_t frameCycle)
+{
+    if (speed != 1 || (mode == PACER_AUDIO && audioWait))
+        return;
+    // deadline holds the start of the frame being emulated until Pacer_frame
+    uint64_t target = deadline + periodWhole * frameCycle / CLOCKS_PER_FRAME;
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (target < now + freq * IDLE_MIN_MS / 1000)
+        return;
+    // undershoot by a millisecond, the end of frame wait takes up the slack
+    SDL_Delay((uint32_t)((target - now) * 1000 / freq) - 1);
+}
+
+static void pace(uint64_t now)
+{
+    if (!speed)
+    {
+        deadline = now;
+        return;
+    }
+
+    deadline += periodWhole;
+    remAccum += periodRem;
+    if (remAccum >= periodDiv)
+    {
+        deadline++;
+        remAccum -= periodDiv;
+    }
+
+    if (speed == 1)
+    {
+        switch (mode)
+        {
+            case PACER_TIMED:
+                break;
+            case PACER_VSYNC:
+                // the blocking present is the clock, only step in if the
+                // driver ignored the vsync request
+                if (deadline <= now + periodWhole / 2)
+                {
+                    deadline = now;
+                    return;
+                }
+                break;
+            case PACER_AUDIO:
+                if (audioWait)
+                {
+                    audioWait();
+                    deadline = SDL_GetPerformanceCounter();
+                    return;
+                }
+                break;
+        }
+    }
+
+    if (now > deadline + periodWhole * MAX_LAG_FRAMES)
+    {
+        if (speed == 1)
+            PRINT(("pacer fell %.1f ms behind, resyncing\n",
+                (now - deadline) * 1000.0 / freq));
+        deadline = now;
+        return;
+    }
+    if (deadline > now)
+        waitUntil(deadline);
+}
+
+static void report(void)
+{
+    if (frameCount % REPORT_FRAMES)
+        return;
+    if (reportSkipped)
+        PRINT(("frameskip: skipped %u of the last %u frames, host %.2f ms/frame\n",
+            reportSkipped, REPORT_FRAMES,
+            reportHostTime * 1000.0 / freq / REPORT_FRAMES));
+    reportSkipped = 0;
+    reportHostTime = 0;
+}
+
+void Pacer_frame(void)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+    frameCount++;
+    if (workStart)
+        reportHostTime += now - workStart;
+    report();
+    pace(now);
+    workStart = SDL_GetPerformanceCounter();
+}
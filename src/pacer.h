@@ -0,0 +1,26 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+
+typedef enum {
+    PACER_TIMED,
+    PACER_VSYNC,
+    PACER_AUDIO
+} PacerMode;
+
+void Pacer_init(PacerMode mode);
+PacerMode Pacer_mode(void);
+void Pacer_setAudioWait(void (*wait)(void));
+void Pacer_setTurboSpeed(uint8_t speed);
+void Pacer_setTurbo(uint8_t enable);
+uint8_t Pacer_turbo(void);
+uint8_t Pacer_speed(void);
+void Pacer_setMaxFrameSkip(uint8_t frames);
+uint32_t Pacer_skippedFrames(void);
+uint8_t Pacer_presentDue(void);
+void Pacer_presented(void);
+void Pacer_idle(uint32_t frameCycle);
+void Pacer_frame(void);
+
+#endif
@@ -0,0 +1,70 @@
+#include "palette.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_SHADES 4
+
+typedef struct
+{
+    const char *name;
+    uint32_t colors[NUM_SHADES];
+} NamedPalette;
+
+// ARGB8888, lightest shade first
+static const NamedPalette s_palettes[] =
+{
+    {"gray", {0xFFE8E8E8, 0xFFA0A0A0, 0xFF585858, 0xFF101010}},
+    {"dmg", {0xFF9BBC0F, 0xFF8BAC0F, 0xFF306230, 0xFF0F380F}},
+    {"pocket", {0xFFC4CFA1, 0xFF8B956D, 0xFF4D533C, 0xFF1F1F1F}},
+};
+#define NUM_PALETTES (sizeof(s_palettes) / sizeof(s_palettes[0]))
+
+static uint32_t s_colors[NUM_SHADES] = {0xFFE8E8E8, 0xFFA0A0A0, 0xFF585858, 0xFF101010};
+static uint8_t current = 0;
+
+// Either the name of a built in palette or four comma separated RRGGBB
+// colours, lightest first
+uint8_t Palette_set(const char *spec)
+{
+    for (uint8_t i = 0; i < NUM_PALETTES; i++)
+    {
+        if (!strcmp(spec, s_palettes[i].name))
+        {
+            memcpy(s_colors, s_palettes[i].colors, sizeof(s_colors));
+            current = i;
+            return 1;
+        }
+    }
+
+    uint32_t colors[NUM_SHADES];
+    const char *p = spec;
+    for (uint8_t i = 0; i < NUM_SHADES; i++)
+    {
+        char *end;
+        unsigned long rgb = strtoul(p, &end, 16);
+        if (end - p != 6 || *end != (i == NUM_SHADES - 1 ? '\0' : ','))
+            return 0;
+        colors[i] = 0xFF000000 | rgb;
+        p = end + 1;
+    }
+    memcpy(s_colors, colors, sizeof(s_colors));
+    return 1;
+}
+
+void Palette_next(void)
+{
+    current = (current + 1) % NUM_PALETTES;
+    memcpy(s_colors, s_palettes[current].colors, sizeof(s_colors));
+}
+
+uint32_t Palette_color(uint8_t shade)
+{
+    return s_colors[shade & 3];
+}
+
+void Palette_apply(const uint8_t *shades, uint32_t *out, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++)
+        out[i] = s_colors[shades[i]];
+}
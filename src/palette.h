@@ -0,0 +1,11 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+
+uint8_t Palette_set(const char *spec);
+void Palette_next(void);
+uint32_t Palette_color(uint8_t shade);
+void Palette_apply(const uint8_t *shades, uint32_t *out, uint32_t count);
+
+#endif
@@ -0,0 +1,221 @@
+#include "recorder.h"
+
+#include "palette.h"
+#include "renderer.h"
+
+#include "SDL/SDL.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Frames go into a fixed ring that a writer thread drains to disk. When the
+// writer falls that far behind frames are dropped rather than ever making
+// the caller wait.
+#define QUEUE_FRAMES 32
+#define FRAME_PIXELS (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+// Duplicates carry no pixels, the writer repeats the last frame it had
+typedef struct
+{
+    uint32_t frame;
+    uint64_t hash;
+    uint8_t duplicate;
+    uint32_t colors[NUM_COLORS];
+    uint8_t shades[FRAME_PIXELS];
+} QueuedFrame;
+
+static QueuedFrame queue[QUEUE_FRAMES];
+static SDL_atomic_t queueHead = {0};
+static SDL_atomic_t queueTail = {0};
+static SDL_atomic_t stopping = {0};
+static SDL_sem *pending = NULL;
+static SDL_Thread *writer = NULL;
+
+static uint8_t recording = 0;
+static uint64_t lastHash = 0;
+static uint8_t haveLast = 0;
+static uint32_t dropped = 0;
+
+// Writer side. Y4M has to hold every frame to keep time, so duplicates are
+// written again; the raw stream stores each distinct frame once and the
+// index says where to find it.
+static uint8_t y4m = 0;
+static FILE *video = NULL;
+static FILE *indexFile = NULL;
+static uint64_t offset = 0;
+static uint64_t lastOffset = 0;
+static uint8_t lastPlanes[3][FRAME_PIXELS];
+static uint8_t lastRgb[FRAME_PIXELS * 3];
+static uint32_t written = 0;
+static uint32_t duplicates = 0;
+
+// The palette goes in too, a still screen changes when the palette does
+static uint64_t hashFrame(const uint8_t *shades)
+{
+    uint64_t hash = 1469598103934665603ULL;
+    for (uint8_t i = 0; i < NUM_COLORS; i++)
+        hash = (hash ^ Palette_color(i)) * 1099511628211ULL;
+    for (uint32_t i = 0; i < FRAME_PIXELS; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, shades + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+// BT.601, studio range
+static void toYuv(uint32_t color, uint8_t yuv[3])
+{
+    int32_t r = (color >> 16) & 0xFF;
+    int32_t g = (color >> 8) & 0xFF;
+    int32_t b = color & 0xFF;
+    yuv[0] = 16 + ((66 * r + 129 * g + 25 * b + 128) >> 8);
+    yuv[1] = 128 + ((-38 * r - 74 * g + 112 * b + 128) >> 8);
+    yuv[2] = 128 + ((112 * r - 94 * g - 18 * b + 128) >> 8);
+}
+
+static void convert(const QueuedFrame *q)
+{
+    if (y4m)
+    {
+        uint8_t lut[NUM_COLORS][3];
+        for (uint8_t i = 0; i < NUM_COLORS; i++)
+            toYuv(q->colors[i], lut[i]);
+        for (uint32_t i = 0; i < FRAME_PIXELS; i++)
+            for (uint8_t plane = 0; plane < 3; plane++)
+                lastPlanes[plane][i] = lut[q->shades[i]][plane];
+        return;
+    }
+    for (uint32_t i = 0; i < FRAME_PIXELS; i++)
+    {
+        uint32_t color = q->colors[q->shades[i]];
+        lastRgb[i * 3] = (color >> 16) & 0xFF;
+        lastRgb[i * 3 + 1] = (color >> 8) & 0xFF;
+        lastRgb[i * 3 + 2] = color & 0xFF;
+    }
+}
+
+static void writeFrame(const QueuedFrame *q)
+{
+    if (!q->duplicate)
+        convert(q);
+    else
+        duplicates++;
+    if (y4m)
+    {
+        lastOffset = offset;
+        fputs("FRAME\n", video);
+        fwrite(lastPlanes, 1, sizeof(lastPlanes), video);
+        offset += 6 + sizeof(lastPlanes);
+    }
+    else if (!q->duplicate)
+    {
+        lastOffset = offset;
+        fwrite(lastRgb, 1, sizeof(lastRgb), video);
+        offset += sizeof(lastRgb);
+    }
+    fprintf(indexFile, "%u %016" PRIx64 " %" PRIu64 " %u\n", q->frame, q->hash,
+        lastOffset, q->duplicate);
+    written++;
+}
+
+static int writeFrames(void *data)
+{
+    (void)data;
+    while (1)
+    {
+        SDL_SemWait(pending);
+        uint8_t stop = SDL_AtomicGet(&stopping);
+        uint32_t tail = SDL_AtomicGet(&queueTail);
+        uint32_t head = SDL_AtomicGet(&queueHead);
+        SDL_MemoryBarrierAcquire();
+        for (; tail != head; tail++)
+        {
+            writeFrame(&queue[tail % QUEUE_FRAMES]);
+            SDL_AtomicSet(&queueTail, tail + 1);
+        }
+        if (stop)
+            return 0;
+    }
+}
+
+// A .y4m path gets a 4:4:4 Y4M stream, anything else raw RGB24 frames. The
+// index next to it lists every frame with its hash and where its pixels are.
+void Recorder_start(const char *path)
+{
+    size_t length = strlen(path);
+    y4m = length > 4 && !strcmp(path + length - 4, ".y4m");
+    video = fopen(path, "wb");
+    char indexName[1024];
+    snprintf(indexName, sizeof(indexName), "%s.idx", path);
+    indexFile = fopen(indexName, "w");
+    if (!video || !indexFile)
+    {
+        printf("Failed to open recording %s\n", path);
+        exit(1);
+    }
+    if (y4m)
+        offset = fprintf(video, "YUV4MPEG2 W%d H%d F4194304:70224 Ip A1:1 C444\n",
+            SCREEN_WIDTH, SCREEN_HEIGHT);
+    fprintf(indexFile, "# %s %dx%d, frame hash offset duplicate\n",
+        y4m ? "y4m" : "rgb24", SCREEN_WIDTH, SCREEN_HEIGHT);
+
+    pending = SDL_CreateSemaphore(0);
+    writer = pending ? SDL_CreateThread(writeFrames, "recorder", NULL) : NULL;
+    if (!writer)
+    {
+        printf("Failed to start recorder thread\n");
+        exit(1);
+    }
+    recording = 1;
+    atexit(Recorder_stop);
+}
+
+uint8_t Recorder_active(void)
+{
+    return recording;
+}
+
+void Recorder_frame(const uint8_t *shades, uint32_t frame)
+{
+    if (!recording)
+        return;
+    uint32_t head = SDL_AtomicGet(&queueHead);
+    if (head - (uint32_t)SDL_AtomicGet(&queueTail) == QUEUE_FRAMES)
+    {
+        dropped++;
+        return;
+    }
+    QueuedFrame *q = &queue[head % QUEUE_FRAMES];
+    q->frame = frame;
+    q->hash = hashFrame(shades);
+    q->duplicate = haveLast && q->hash == lastHash;
+    if (!q->duplicate)
+    {
+        for (uint8_t i = 0; i < NUM_COLORS; i++)
+            q->colors[i] = Palette_color(i);
+        memcpy(q->shades, shades, FRAME_PIXELS);
+    }
+    lastHash = q->hash;
+    haveLast = 1;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&queueHead, head + 1);
+    SDL_SemPost(pending);
+}
+
+void Recorder_stop(void)
+{
+    if (!recording)
+        return;
+    recording = 0;
+    SDL_AtomicSet(&stopping, 1);
+    SDL_SemPost(pending);
+    SDL_WaitThread(writer, NULL);
+    fclose(video);
+    fclose(indexFile);
+    printf("recorded %u frames, %u duplicates, %u dropped\n",
+        written, duplicates, dropped);
+}
@@ -0,0 +1,11 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdint.h>
+
+void Recorder_start(const char *path);
+uint8_t Recorder_active(void);
+void Recorder_frame(const uint8_t *shades, uint32_t frame);
+void Recorder_stop(void);
+
+#endif
@@ -0,0 +1,410 @@
+#include "renderer.h"
+
+#include "debug.h"
+
+#include <string.h>
+
+// The renderer's own copy of VRAM and OAM, brought up to date from the frame
+// log one line at a time
+static uint8_t vram[VRAM_SIZE];
+static uint8_t oam[OAM_SIZE];
+
+// One shade (0-3, lightest first) per pixel, the colours they stand for are
+// only picked when the frame is presented
+static uint8_t framebuffer[SCREEN_HEIGHT][SCREEN_WIDTH];
+
+// Sprites selected for each line, front to back
+#define NUM_SPRITES 40
+#define MAX_LINE_SPRITES 10
+static uint8_t lineSprites[SCREEN_HEIGHT][MAX_LINE_SPRITES];
+static uint8_t lineSpriteCount[SCREEN_HEIGHT];
+static uint8_t spritesDirty = 1;
+static uint8_t selectedSpriteSize = 0;
+
+// Background/window layers indexed by tile data select and tile map select,
+// with the tile and tile version each map entry was last drawn from
+#define LAYER_SIZE 256
+#define NUM_TILES 384
+typedef struct
+{
+    uint8_t pixels[LAYER_SIZE][LAYER_SIZE];
+    uint16_t tiles[32 * 32];
+    uint32_t versions[32 * 32];
+} Layer;
+static Layer layers[2][2];
+static uint32_t tileVersions[NUM_TILES];
+static uint8_t layersReady = 0;
+
+// Everything a composed line depends on, the line is reused while it matches.
+// Versions start at 1 so no line matches before it has been drawn.
+typedef struct
+{
+    uint32_t vramVersion, oamVersion;
+    uint8_t lcdc, scrollX, scrollY, windowX, windowY, windowLine;
+    uint8_t bgPalette, objPalette0, objPalette1;
+} LineSignature;
+static uint32_t vramVersion = 1;
+static uint32_t oamVersion = 1;
+static LineSignature lineSignatures[SCREEN_HEIGHT];
+static uint8_t firstChangedLine = SCREEN_HEIGHT;
+static uint8_t lastChangedLine = 0;
+
+// Window line counter, only advances on lines the window is drawn
+static uint8_t windowLine = 0;
+
+// Number of the frame expected next, anything else means frames were skipped
+static uint32_t nextFrame = 0;
+
+// LCDC bits
+#define LCDC_WINDOW_MAP(lcdc) (((lcdc) >> 6) & 1)
+#define LCDC_WINDOW(lcdc) (((lcdc) >> 5) & 1)
+#define LCDC_TILE_DATA(lcdc) (((lcdc) >> 4) & 1)
+#define LCDC_BG_MAP(lcdc) (((lcdc) >> 3) & 1)
+#define LCDC_SPRITE_SIZE(lcdc) (((lcdc) >> 2) & 1)
+#define LCDC_SPRITES(lcdc) (((lcdc) >> 1) & 1)
+#define LCDC_BG(lcdc) ((lcdc) & 1)
+
+static void applyWrite(uint16_t addr, uint8_t val)
+{
+    if (addr < VRAM_SIZE)
+    {
+        vram[addr] = val;
+        if (addr < 0x1800)
+            tileVersions[addr / 16]++;
+        vramVersion++;
+    }
+    else
+    {
+        oam[addr - 0x7E00] = val;
+        spritesDirty = 1;
+        oamVersion++;
+    }
+}
+
+// Take on VRAM and OAM wholesale, every cache keyed on them is stale after
+static void load(const uint8_t *vram_, const uint8_t *oam_)
+{
+    memcpy(vram, vram_, VRAM_SIZE);
+    memcpy(oam, oam_, OAM_SIZE);
+    for (uint16_t i = 0; i < NUM_TILES; i++)
+        tileVersions[i]++;
+    vramVersion++;
+    oamVersion++;
+    spritesDirty = 1;
+}
+
+static inline uint8_t colorIndexAt(uint16_t tileLine, uint8_t x)
+{
+    uint8_t l = tileLine & 0xFF;
+    uint8_t h = (tileLine >> 8) & 0xFF;
+    uint8_t pixelOffset = 7 - x; // leftmost pixel is 7th bit
+    return ((l >> pixelOffset) & 1) | (((h >> pixelOffset) & 1) << 1);
+}
+
+// The background and window are slices of a 256x256 layer built from one of
+// the two tile maps in one of the two tile data modes. All four combinations
+// are kept fully drawn as colour indexes, and a map entry is redrawn only when
+// it points at a different tile or that tile's data was written since.
+static uint16_t resolveTile(uint8_t tileData, uint8_t mapEntry)
+{
+    return tileData ? mapEntry : 256 + (int8_t)mapEntry;
+}
+
+static void drawLayerTile(uint8_t layer[LAYER_SIZE][LAYER_SIZE], uint8_t row,
+    uint8_t col, uint16_t tile)
+{
+    const uint8_t *pixels = vram + tile * 16;
+    for (uint8_t y = 0; y < 8; y++)
+    {
+        uint16_t tileLine = pixels[y * 2] + ((uint16_t)pixels[y * 2 + 1] << 8);
+        uint8_t *out = &layer[row * 8 + y][col * 8];
+        for (uint8_t x = 0; x < 8; x++)
+            out[x] = colorIndexAt(tileLine, x);
+    }
+}
+
+static const uint8_t *layerLine(uint8_t tileData, uint8_t tileMap, uint8_t y)
+{
+    Layer *layer = &layers[tileData][tileMap];
+    uint8_t row = y / 8;
+    const uint8_t *map = vram + (tileMap ? 0x1C00 : 0x1800) + row * 32;
+    for (uint8_t col = 0; col < 32; col++)
+    {
+        uint16_t index = row * 32 + col;
+        uint16_t tile = resolveTile(tileData, map[col]);
+        if (layer->tiles[index] == tile && layer->versions[index] == tileVersions[tile])
+            continue;
+        drawLayerTile(layer->pixels, row, col, tile);
+        layer->tiles[index] = tile;
+        layer->versions[index] = tileVersions[tile];
+    }
+    return layer->pixels[y];
+}
+
+static inline void renderBg(const LineRegs *regs, uint8_t line, uint8_t tileData,
+    uint8_t colorIndexes[SCREEN_WIDTH])
+{
+    const uint8_t *src = layerLine(tileData, LCDC_BG_MAP(regs->lcdc), line + regs->scrollY);
+    uint16_t firstPart = LAYER_SIZE - regs->scrollX;
+    if (firstPart >= SCREEN_WIDTH)
+    {
+        memcpy(colorIndexes, src + regs->scrollX, SCREEN_WIDTH);
+        return;
+    }
+    memcpy(colorIndexes, src + regs->scrollX, firstPart);
+    memcpy(colorIndexes + firstPart, src, SCREEN_WIDTH - firstPart);
+}
+
+static inline void renderWindow(const LineRegs *regs, uint8_t tileData,
+    uint8_t colorIndexes[SCREEN_WIDTH])
+{
+    const uint8_t *src = layerLine(tileData, LCDC_WINDOW_MAP(regs->lcdc), windowLine);
+    int16_t start = regs->windowX - 7;
+    if (start < 0)
+        memcpy(colorIndexes, src - start, SCREEN_WIDTH);
+    else
+        memcpy(colorIndexes + start, src, SCREEN_WIDTH - start);
+}
+
+// Hardware picks the first 10 sprites in OAM order that overlap a line, and
+// among those the one with the smallest X (then lowest OAM index) is drawn on
+// top. OAM changes rarely compared to how often lines are drawn, so the
+// selection is redone only after an OAM write, DMA or sprite size change and
+// each line keeps its sprites sorted front to back.
+static void selectSprites(uint8_t spriteSize)
+{
+    memset(lineSpriteCount, 0, sizeof(lineSpriteCount));
+    uint8_t height = spriteSize ? 16 : 8;
+    for (uint8_t sprite = 0; sprite < NUM_SPRITES; sprite++)
+    {
+        int16_t spriteY = oam[sprite * 4] - 16;
+        for (int16_t y = spriteY; y < spriteY + height; y++)
+        {
+            if (y < 0 || y >= SCREEN_HEIGHT || lineSpriteCount[y] == MAX_LINE_SPRITES)
+                continue;
+            uint8_t *sprites = lineSprites[y];
+            uint8_t count = lineSpriteCount[y]++;
+            // insertion sort, OAM order already breaks ties
+            uint8_t spriteX = oam[sprite * 4 + 1];
+            while (count && oam[sprites[count - 1] * 4 + 1] > spriteX)
+            {
+                sprites[count] = sprites[count - 1];
+                count--;
+            }
+            sprites[count] = sprite;
+        }
+    }
+    selectedSpriteSize = spriteSize;
+    spritesDirty = 0;
+}
+
+static inline void renderSprites(const LineRegs *regs, uint8_t line, uint8_t spriteSize,
+    const uint8_t bgColorIndexes[SCREEN_WIDTH], uint8_t *out)
+{
+    if (spritesDirty || spriteSize != selectedSpriteSize)
+        selectSprites(spriteSize);
+
+    uint8_t height = spriteSize ? 16 : 8;
+    uint8_t covered[SCREEN_WIDTH] = {0};
+    for (uint8_t s = 0; s < lineSpriteCount[line]; s++)
+    {
+        const uint8_t *sprite = oam + lineSprites[line][s] * 4;
+        uint8_t y = line - (sprite[0] - 16);
+        int16_t spriteX = sprite[1] - 8;
+        uint16_t tile = (spriteSize ? sprite[2] & 0xFE : sprite[2]) * 16;
+        uint8_t flags = sprite[3];
+
+        uint8_t palette = (flags >> 4) & 1 ? regs->objPalette1 : regs->objPalette0;
+        uint8_t flipX = (flags >> 5) & 1;
+        uint8_t flipY = (flags >> 6) & 1;
+        uint8_t behindBg = (flags >> 7) & 1;
+
+        uint16_t pixelsAddr = tile + ((flipY ? height - 1 - y : y) * 2);
+        uint16_t pixels = vram[pixelsAddr] + ((uint16_t)vram[pixelsAddr + 1] << 8);
+        for (uint8_t x = 0; x < 8; x++)
+        {
+            int16_t screenX = spriteX + x;
+            if (screenX < 0 || screenX >= SCREEN_WIDTH || covered[screenX])
+                continue;
+            uint8_t colorIndex = colorIndexAt(pixels, flipX ? 7 - x : x);
+            if (!colorIndex)
+                continue;
+            // a higher priority sprite hides the ones below it even when
+            // the background then hides it
+            covered[screenX] = 1;
+            if (behindBg && bgColorIndexes[screenX])
+                continue;
+            out[screenX] = (palette >> (colorIndex * 2)) & 3;
+        }
+    }
+}
+
+// Composes a line for one LCDC configuration. Only ever called with constant
+// flags, so each line renderer below is built with the disabled layers and
+// the other tile data and sprite size modes compiled out.
+static inline void composeLine(const LineRegs *regs, uint8_t line,
+    uint8_t windowVisible, uint8_t *out, const uint8_t bg, const uint8_t window,
+    const uint8_t sprites, const uint8_t spriteSize, const uint8_t tileData)
+{
+    uint8_t colorIndexes[SCREEN_WIDTH];
+    if (bg)
+    {
+        renderBg(regs, line, tileData, colorIndexes);
+        if (window && windowVisible)
+            renderWindow(regs, tileData, colorIndexes);
+        for (uint8_t i = 0; i < SCREEN_WIDTH; i++)
+            out[i] = (regs->bgPalette >> (colorIndexes[i] * 2)) & 3;
+    }
+    else
+    {
+        // with LCDC bit 0 clear the background and window are blank white
+        // and every sprite shows in front
+        memset(colorIndexes, 0, SCREEN_WIDTH);
+        memset(out, 0, SCREEN_WIDTH);
+    }
+    if (sprites)
+        renderSprites(regs, line, spriteSize, colorIndexes, out);
+}
+
+typedef void (*LineRenderer)(const LineRegs *regs, uint8_t line,
+    uint8_t windowVisible, uint8_t *out);
+
+// Expands X once for each combination of background, window, sprites,
+// sprite size and tile data, in the order of lineRendererIndex
+#define LINE_RENDERERS_5(X, a, b, c, d) X(a, b, c, d, 0) X(a, b, c, d, 1)
+#define LINE_RENDERERS_4(X, a, b, c) LINE_RENDERERS_5(X, a, b, c, 0) LINE_RENDERERS_5(X, a, b, c, 1)
+#define LINE_RENDERERS_3(X, a, b) LINE_RENDERERS_4(X, a, b, 0) LINE_RENDERERS_4(X, a, b, 1)
+#define LINE_RENDERERS_2(X, a) LINE_RENDERERS_3(X, a, 0) LINE_RENDERERS_3(X, a, 1)
+#define FOR_EACH_LINE_RENDERER(X) LINE_RENDERERS_2(X, 0) LINE_RENDERERS_2(X, 1)
+
+#define DEFINE_LINE_RENDERER(bg, window, sprites, spriteSize, tileData) \
+    static void renderLine##bg##window##sprites##spriteSize##tileData( \
+        const LineRegs *regs, uint8_t line, uint8_t windowVisible, uint8_t *out) \
+    { \
+        composeLine(regs, line, windowVisible, out, \
+            bg, window, sprites, spriteSize, tileData); \
+    }
+FOR_EACH_LINE_RENDERER(DEFINE_LINE_RENDERER)
+
+#define LINE_RENDERER_ENTRY(bg, window, sprites, spriteSize, tileData) \
+    renderLine##bg##window##sprites##spriteSize##tileData,
+static const LineRenderer lineRenderers[] = {
+    FOR_EACH_LINE_RENDERER(LINE_RENDERER_ENTRY)
+};
+
+static inline uint8_t lineRendererIndex(uint8_t lcdc)
+{
+    return (LCDC_BG(lcdc) << 4) | (LCDC_WINDOW(lcdc) << 3) |
+           (LCDC_SPRITES(lcdc) << 2) | (LCDC_SPRITE_SIZE(lcdc) << 1) |
+           LCDC_TILE_DATA(lcdc);
+}
+
+static void renderScanline(const LineRegs *regs, uint8_t line)
+{
+    uint8_t windowVisible = LCDC_WINDOW(regs->lcdc) && line >= regs->windowY &&
+                            regs->windowX <= SCREEN_WIDTH + 6;
+
+    // menus and paused screens redraw the same lines for seconds at a time,
+    // if nothing the line depends on moved since it was last drawn the
+    // framebuffer already holds it. The padding is cleared and copied along
+    // with the fields so the whole struct can be compared.
+    LineSignature signature;
+    memset(&signature, 0, sizeof(signature));
+    signature.vramVersion = vramVersion;
+    signature.oamVersion = oamVersion;
+    signature.lcdc = regs->lcdc;
+    signature.scrollX = regs->scrollX;
+    signature.scrollY = regs->scrollY;
+    signature.windowX = regs->windowX;
+    signature.windowY = regs->windowY;
+    signature.windowLine = windowVisible ? windowLine : 0;
+    signature.bgPalette = regs->bgPalette;
+    signature.objPalette0 = regs->objPalette0;
+    signature.objPalette1 = regs->objPalette1;
+    if (memcmp(&signature, &lineSignatures[line], sizeof(signature)))
+    {
+        memcpy(&lineSignatures[line], &signature, sizeof(signature));
+        if (line < firstChangedLine)
+            firstChangedLine = line;
+        if (line > lastChangedLine)
+            lastChangedLine = line;
+
+        lineRenderers[lineRendererIndex(regs->lcdc)](regs, line, windowVisible,
+            framebuffer[line]);
+    }
+    if (windowVisible)
+        windowLine++;
+}
+
+static void copyLine(const uint8_t *pixels, uint8_t line)
+{
+    // whatever the scanline engine last drew here is gone
+    memset(&lineSignatures[line], 0, sizeof(lineSignatures[line]));
+    if (!memcmp(framebuffer[line], pixels, SCREEN_WIDTH))
+        return;
+    memcpy(framebuffer[line], pixels, SCREEN_WIDTH);
+    if (line < firstChangedLine)
+        firstChangedLine = line;
+    if (line > lastChangedLine)
+        lastChangedLine = line;
+}
+
+// Replays the frame's writes in order, drawing each line once the writes
+// that happened before it have landed. Lines are only composed when draw is
+// set, but the copy of VRAM/OAM is kept current either way.
+void Renderer_frame(const FrameLog *log, uint8_t draw)
+{
+    if (!layersReady)
+    {
+        // no map entry has been drawn yet
+        for (uint8_t i = 0; i < 2; i++)
+            for (uint8_t j = 0; j < 2; j++)
+                memset(layers[i][j].tiles, 0xFF, sizeof(layers[i][j].tiles));
+        layersReady = 1;
+    }
+    if (log->resync || log->frame != nextFrame)
+        load(log->vram, log->oam);
+    nextFrame = log->frame + 1;
+
+    uint16_t applied = 0;
+    uint8_t loadedEnd = 0;
+    windowLine = 0;
+    for (uint8_t line = 0; line < SCREEN_HEIGHT; line++)
+    {
+        const LineRegs *regs = &log->lines[line];
+        if (!regs->drawn)
+            continue;
+        for (; applied < regs->writes; applied++)
+            applyWrite(log->writes[applied].addr, log->writes[applied].val);
+        if (regs->overflowed && !loadedEnd)
+        {
+            load(log->endVram, log->endOam);
+            loadedEnd = 1;
+        }
+        if (draw && regs->composed)
+            copyLine(log->pixels[line], line);
+        else if (draw)
+            renderScanline(regs, line);
+    }
+    if (log->overflowed && !loadedEnd)
+        load(log->endVram, log->endOam);
+    else if (!log->overflowed)
+        for (; applied < log->writeCount; applied++)
+            applyWrite(log->writes[applied].addr, log->writes[applied].val);
+}
+
+const uint8_t *Renderer_framebuffer(void)
+{
+    return &framebuffer[0][0];
+}
+
+uint8_t Renderer_takeChangedLines(uint8_t *first, uint8_t *last)
+{
+    if (firstChangedLine > lastChangedLine)
+        return 0;
+    *first = firstChangedLine;
+    *last = lastChangedLine;
+    firstChangedLine = SCREEN_HEIGHT;
+    lastChangedLine = 0;
+    return 1;
+}
@@ -0,0 +1,63 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <stdint.h>
+
+#define SCREEN_WIDTH 160
+#define SCREEN_HEIGHT 144
+
+#define VRAM_SIZE 0x2000
+#define OAM_SIZE 0xA0
+#define NUM_COLORS 4
+
+// Log entries per frame, enough for a frame's worth of vblank copies and a
+// generous number of OAM DMAs
+#define MAX_FRAME_WRITES 16384
+
+// Registers latched when a line leaves mode 3, and how much of the frame's
+// write log had happened by then. Lines the FIFO engine already drew are
+// marked composed and come with their pixels.
+typedef struct
+{
+    uint8_t drawn;
+    uint8_t overflowed;
+    uint8_t composed;
+    uint8_t lcdc;
+    uint8_t scrollX, scrollY;
+    uint8_t windowX, windowY;
+    uint8_t bgPalette, objPalette0, objPalette1;
+    uint16_t writes;
+} LineRegs;
+
+// addr is relative to 0x8000, so OAM writes land at 0x7E00 and up
+typedef struct
+{
+    uint16_t addr;
+    uint8_t val;
+} VideoWrite;
+
+// Everything needed to draw one frame after the fact: VRAM and OAM as they
+// were at the previous vblank, every write to them since, and the registers
+// each line was drawn with. If the log fills up the remaining lines are drawn
+// from the state at the end of the frame instead. Frames are numbered so the
+// renderer can tell when it missed one and has to start from vram/oam.
+typedef struct
+{
+    uint8_t resync;
+    uint32_t frame;
+    uint8_t vram[VRAM_SIZE];
+    uint8_t oam[OAM_SIZE];
+    LineRegs lines[SCREEN_HEIGHT];
+    VideoWrite writes[MAX_FRAME_WRITES];
+    uint16_t writeCount;
+    uint8_t overflowed;
+    uint8_t endVram[VRAM_SIZE];
+    uint8_t endOam[OAM_SIZE];
+    uint8_t pixels[SCREEN_HEIGHT][SCREEN_WIDTH];
+} FrameLog;
+
+void Renderer_frame(const FrameLog *log, uint8_t draw);
+const uint8_t *Renderer_framebuffer(void);
+uint8_t Renderer_takeChangedLines(uint8_t *first, uint8_t *last);
+
+#endif
@@ -0,0 +1,161 @@
+#include "rewind.h"
+
+#include "lz.h"
+#include "state.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every frame the state is XORed with the one before, which leaves zeros
+// wherever nothing changed, and compressed into a ring. Going back a frame
+// decompresses the newest delta and XORs it into the latest state. The
+// oldest frames are dropped to stay within the budget.
+
+typedef struct
+{
+    uint32_t offset;
+    uint32_t size;
+} Record;
+
+static uint8_t enabled = 0;
+static uint8_t active = 0;
+
+static uint32_t imageSize = 0;
+static uint8_t *latest = NULL;
+static uint8_t *current = NULL;
+static uint8_t *compressed = NULL;
+
+static uint8_t *ring = NULL;
+static uint32_t ringSize = 0;
+static uint32_t writePos = 0;
+
+static Record *records = NULL;
+static uint32_t maxRecords = 0;
+static uint32_t firstRecord = 0;
+static uint32_t recordCount = 0;
+
+static Record *record(uint32_t i)
+{
+    return &records[(firstRecord + i) % maxRecords];
+}
+
+static void dropOldest(void)
+{
+    firstRecord = (firstRecord + 1) % maxRecords;
+    recordCount--;
+}
+
+static void xorInto(uint8_t *out, const uint8_t *in)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= imageSize; i += 8)
+    {
+        uint64_t a, b;
+        memcpy(&a, out + i, 8);
+        memcpy(&b, in + i, 8);
+        a ^= b;
+        memcpy(out + i, &a, 8);
+    }
+    for (; i < imageSize; i++)
+        out[i] ^= in[i];
+}
+
+// Space for a new frame comes from the oldest ones, the ring is filled in
+// order and wraps rather than splitting a frame across the end
+static uint8_t *allocate(uint32_t size)
+{
+    if (size > ringSize)
+        return NULL;
+    if (recordCount == maxRecords)
+        dropOldest();
+    if (writePos + size > ringSize)
+    {
+        while (recordCount && record(0)->offset >= writePos)
+            dropOldest();
+        writePos = 0;
+    }
+    while (recordCount && record(0)->offset < writePos + size &&
+        record(0)->offset + record(0)->size > writePos)
+        dropOldest();
+    if (!recordCount)
+        writePos = 0;
+
+    Record *added = record(recordCount++);
+    added->offset = writePos;
+    added->size = size;
+    writePos += size;
+    return ring + added->offset;
+}
+
+static void capture(void)
+{
+    State_write(current);
+    xorInto(latest, current);
+    uint32_t size = Lz_compress(latest, imageSize, compressed);
+    uint8_t *out = allocate(size);
+    if (out)
+        memcpy(out, compressed, size);
+    else
+        recordCount = 0;
+    uint8_t *swap = latest;
+    latest = current;
+    current = swap;
+}
+
+// Steps back a frame and holds at the oldest one. The first frame kept is
+// against an empty state, so it can't be undone.
+static void stepBack(void)
+{
+    if (recordCount > 1)
+    {
+        Record *newest = record(recordCount - 1);
+        uint32_t size = Lz_decompress(ring + newest->offset, newest->size, current, imageSize);
+        if (size == imageSize)
+        {
+            xorInto(latest, current);
+            writePos = newest->offset;
+            recordCount--;
+        }
+    }
+    if (recordCount)
+        State_read(latest, imageSize);
+}
+
+// A delta of all zeros, from a frame where nothing changed, is about the
+// smallest there is. The list of frames is sized to hold a ring full of
+// those, so it is the ring that runs out first.
+void Rewind_init(uint32_t budget)
+{
+    imageSize = State_size();
+    latest = calloc(1, imageSize);
+    current = calloc(1, imageSize);
+    compressed = malloc(Lz_bound(imageSize));
+    if (latest && current && compressed)
+        maxRecords = budget / (Lz_compress(current, imageSize, compressed) + sizeof(Record));
+    ringSize = budget - maxRecords * sizeof(Record);
+    ring = malloc(ringSize);
+    records = malloc(maxRecords * sizeof(Record));
+    if (!latest || !current || !compressed || !ring || !records || !maxRecords)
+    {
+        printf("Failed to allocate rewind buffer\n");
+        exit(1);
+    }
+    enabled = 1;
+}
+
+void Rewind_setActive(uint8_t active_)
+{
+    active = active_;
+}
+
+// Called between frames. While active each frame shown is one further back.
+void Rewind_frame(void)
+{
+    if (!enabled)
+        return;
+    if (active)
+        stepBack();
+    else
+        capture();
+}
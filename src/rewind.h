@@ -0,0 +1,10 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stdint.h>
+
+void Rewind_init(uint32_t budget);
+void Rewind_setActive(uint8_t active);
+void Rewind_frame(void);
+
+#endif
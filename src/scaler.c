@@ -0,0 +1,203 @@
+#include "scaler.h"
+
+#include "palette.h"
+#include "renderer.h"
+
+#include <string.h>
+
+#define MAX_SCALE 8
+
+static ScalerFilter filter = SCALER_NEAREST;
+static uint8_t scale = 3;
+
+// The edge detecting filters compare 16 shades at a time, gcc lowers these
+// to SSE2 or NEON
+#define LANES 16
+typedef uint8_t Vec __attribute__((vector_size(LANES)));
+
+// Source lines padded on both sides so the left and right neighbours load
+// without edge checks, the padding repeats the outermost pixel
+#define PAD LANES
+typedef uint8_t PaddedLine[PAD + SCREEN_WIDTH + PAD];
+
+uint8_t Scaler_setFilter(const char *name)
+{
+    if (!strcmp(name, "nearest"))
+        filter = SCALER_NEAREST;
+    else if (!strcmp(name, "scale2x"))
+        filter = SCALER_SCALE2X;
+    else if (!strcmp(name, "scale3x"))
+        filter = SCALER_SCALE3X;
+    else
+        return 0;
+    return 1;
+}
+
+uint8_t Scaler_setScale(uint8_t scale_)
+{
+    if (!scale_ || scale_ > MAX_SCALE)
+        return 0;
+    scale = scale_;
+    return 1;
+}
+
+// Output pixels per frame pixel, the edge filters have a fixed one
+uint8_t Scaler_factor(void)
+{
+    switch (filter)
+    {
+        case SCALER_SCALE2X:
+            return 2;
+        case SCALER_SCALE3X:
+            return 3;
+        default:
+            return scale;
+    }
+}
+
+// How many lines either side of a changed line its output reaches into
+uint8_t Scaler_border(void)
+{
+    return filter == SCALER_NEAREST ? 0 : 1;
+}
+
+static inline Vec load(const uint8_t *p)
+{
+    Vec v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline Vec eq(Vec a, Vec b)
+{
+    return (Vec)(a == b);
+}
+
+static inline Vec ne(Vec a, Vec b)
+{
+    return (Vec)(a != b);
+}
+
+static inline Vec blend(Vec mask, Vec a, Vec b)
+{
+    return (mask & a) | (~mask & b);
+}
+
+static void padLine(PaddedLine out, const uint8_t *frame, int16_t y)
+{
+    if (y < 0)
+        y = 0;
+    if (y >= SCREEN_HEIGHT)
+        y = SCREEN_HEIGHT - 1;
+    const uint8_t *src = frame + y * SCREEN_WIDTH;
+    memcpy(out + PAD, src, SCREEN_WIDTH);
+    out[PAD - 1] = src[0];
+    out[PAD + SCREEN_WIDTH] = src[SCREEN_WIDTH - 1];
+}
+
+static void nearest(const uint8_t *src, uint8_t *out, int pitch)
+{
+    uint32_t colors[SCREEN_WIDTH];
+    Palette_apply(src, colors, SCREEN_WIDTH);
+    uint32_t *row = (uint32_t *)out;
+    for (uint16_t x = 0; x < SCREEN_WIDTH; x++)
+        for (uint8_t i = 0; i < scale; i++)
+            *row++ = colors[x];
+    for (uint8_t i = 1; i < scale; i++)
+        memcpy(out + i * pitch, out, SCREEN_WIDTH * scale * sizeof(uint32_t));
+}
+
+// Scale2x, each pixel E becomes four from its neighbours
+//   B      E0 E1
+// D E F    E2 E3
+//   H
+static void scale2x(const PaddedLine up, const PaddedLine mid,
+    const PaddedLine down, uint8_t *out, int pitch)
+{
+    uint8_t rows[2][SCREEN_WIDTH * 2];
+    for (uint16_t x = PAD; x < PAD + SCREEN_WIDTH; x += LANES)
+    {
+        Vec b = load(up + x), h = load(down + x);
+        Vec d = load(mid + x - 1), e = load(mid + x), f = load(mid + x + 1);
+        Vec c = ne(b, h) & ne(d, f);
+        Vec e0 = blend(c & eq(d, b), d, e);
+        Vec e1 = blend(c & eq(b, f), f, e);
+        Vec e2 = blend(c & eq(d, h), d, e);
+        Vec e3 = blend(c & eq(h, f), f, e);
+        uint8_t *r0 = rows[0] + (x - PAD) * 2;
+        uint8_t *r1 = rows[1] + (x - PAD) * 2;
+        for (uint8_t i = 0; i < LANES; i++)
+        {
+            r0[i * 2] = e0[i];
+            r0[i * 2 + 1] = e1[i];
+            r1[i * 2] = e2[i];
+            r1[i * 2 + 1] = e3[i];
+        }
+    }
+    for (uint8_t i = 0; i < 2; i++)
+        Palette_apply(rows[i], (uint32_t *)(out + i * pitch), SCREEN_WIDTH * 2);
+}
+
+// Scale3x, each pixel E becomes nine
+// A B C    E0 E1 E2
+// D E F    E3 E4 E5
+// G H I    E6 E7 E8
+static void scale3x(const PaddedLine up, const PaddedLine mid,
+    const PaddedLine down, uint8_t *out, int pitch)
+{
+    uint8_t rows[3][SCREEN_WIDTH * 3];
+    for (uint16_t x = PAD; x < PAD + SCREEN_WIDTH; x += LANES)
+    {
+        Vec a = load(up + x - 1), b = load(up + x), c = load(up + x + 1);
+        Vec d = load(mid + x - 1), e = load(mid + x), f = load(mid + x + 1);
+        Vec g = load(down + x - 1), h = load(down + x), i = load(down + x + 1);
+        Vec edge = ne(b, h) & ne(d, f);
+        Vec db = edge & eq(d, b), bf = edge & eq(b, f);
+        Vec dh = edge & eq(d, h), hf = edge & eq(h, f);
+        Vec planes[9] = {
+            blend(db, d, e),
+            blend((db & ne(e, c)) | (bf & ne(e, a)), b, e),
+            blend(bf, f, e),
+            blend((db & ne(e, g)) | (dh & ne(e, a)), d, e),
+            e,
+            blend((bf & ne(e, i)) | (hf & ne(e, c)), f, e),
+            blend(dh, d, e),
+            blend((dh & ne(e, i)) | (hf & ne(e, g)), h, e),
+            blend(hf, f, e)
+        };
+        for (uint8_t row = 0; row < 3; row++)
+        {
+            uint8_t *r = rows[row] + (x - PAD) * 3;
+            for (uint8_t lane = 0; lane < LANES; lane++)
+                for (uint8_t col = 0; col < 3; col++)
+                    r[lane * 3 + col] = planes[row * 3 + col][lane];
+        }
+    }
+    for (uint8_t row = 0; row < 3; row++)
+        Palette_apply(rows[row], (uint32_t *)(out + row * pitch), SCREEN_WIDTH * 3);
+}
+
+// Scales lines first to last of a frame of shades straight into ARGB output,
+// which starts at the first output row of line first
+void Scaler_lines(const uint8_t *frame, uint8_t first, uint8_t last,
+    void *out, int pitch)
+{
+    uint8_t factor = Scaler_factor();
+    uint8_t *dst = out;
+    PaddedLine lines[3];
+    for (uint16_t y = first; y <= last; y++, dst += pitch * factor)
+    {
+        if (filter == SCALER_NEAREST)
+        {
+            nearest(frame + y * SCREEN_WIDTH, dst, pitch);
+            continue;
+        }
+        padLine(lines[0], frame, y - 1);
+        padLine(lines[1], frame, y);
+        padLine(lines[2], frame, y + 1);
+        if (filter == SCALER_SCALE2X)
+            scale2x(lines[0], lines[1], lines[2], dst, pitch);
+        else
+            scale3x(lines[0], lines[1], lines[2], dst, pitch);
+    }
+}
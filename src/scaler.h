@@ -0,0 +1,19 @@
+#ifndef SCALER_H
+#define SCALER_H
+
+#include <stdint.h>
+
+typedef enum {
+    SCALER_NEAREST,
+    SCALER_SCALE2X,
+    SCALER_SCALE3X
+} ScalerFilter;
+
+uint8_t Scaler_setFilter(const char *name);
+uint8_t Scaler_setScale(uint8_t scale);
+uint8_t Scaler_factor(void);
+uint8_t Scaler_border(void);
+void Scaler_lines(const uint8_t *frame, uint8_t first, uint8_t last,
+    void *out, int pitch);
+
+#endif
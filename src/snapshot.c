@@ -0,0 +1,79 @@
+#include "snapshot.h"
+
+#include <string.h>
+
+// Each snapshot remembers the epoch it last matched the machine in, and the
+// epoch moves on whenever one is taken or restored. A page written since
+// then has a later epoch, anything else is the same in both.
+uint32_t snapshotEpoch = 1;
+uint32_t snapshotPageEpochs[SNAPSHOT_PAGES];
+
+static const uint32_t regionPages[REGION_COUNT] = {
+    PAGE_WORK_RAM,
+    PAGE_HIGH_RAM,
+    PAGE_VRAM,
+    PAGE_OAM,
+    PAGE_EXTERNAL_RAM,
+};
+
+// The region a page belongs to, and where the page is within it
+static uint8_t *pageAddress(uint32_t page, uint32_t *size)
+{
+    StateRegion region = REGION_COUNT - 1;
+    while (page < regionPages[region])
+        region--;
+    uint32_t offset = (page - regionPages[region]) << SNAPSHOT_PAGE_SHIFT;
+    uint32_t left = State_regionSize(region) - offset;
+    *size = left < SNAPSHOT_PAGE_SIZE ? left : SNAPSHOT_PAGE_SIZE;
+    return State_region(region) + offset;
+}
+
+// For when memory was replaced wholesale, every snapshot is out of date
+void Snapshot_touchAll(void)
+{
+    for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++)
+        snapshotPageEpochs[page] = snapshotEpoch;
+}
+
+// The first take copies everything, restoring before that isn't allowed
+void Snapshot_init(Snapshot *snapshot)
+{
+    snapshot->epoch = 0;
+}
+
+// Both return how many pages were copied
+uint32_t Snapshot_take(Snapshot *snapshot)
+{
+    uint32_t copied = 0;
+    for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++)
+    {
+        if (snapshot->epoch && snapshotPageEpochs[page] <= snapshot->epoch)
+            continue;
+        uint32_t size;
+        const uint8_t *address = pageAddress(page, &size);
+        memcpy(snapshot->pages[page], address, size);
+        copied++;
+    }
+    State_saveRegisters(&snapshot->registers);
+    snapshot->epoch = snapshotEpoch++;
+    return copied;
+}
+
+// Restored pages count as written, for the sake of every other snapshot
+uint32_t Snapshot_restore(Snapshot *snapshot)
+{
+    uint32_t copied = 0;
+    for (uint32_t page = 0; page < SNAPSHOT_PAGES; page++)
+    {
+        if (snapshotPageEpochs[page] <= snapshot->epoch)
+            continue;
+        uint32_t size;
+        uint8_t *address = pageAddress(page, &size);
+        memcpy(address, snapshot->pages[page], size);
+        snapshotPageEpochs[page] = snapshotEpoch;
+        copied++;
+    }
+    State_loadRegisters(&snapshot->registers);
+    snapshot->epoch = snapshotEpoch++;
+    return copied;
+}
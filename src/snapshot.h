@@ -0,0 +1,43 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "state.h"
+
+#include <stdint.h>
+
+// Memory regions are tracked in 256 byte pages, numbered across all of them
+// in StateRegion order
+#define SNAPSHOT_PAGE_SHIFT 8
+#define SNAPSHOT_PAGE_SIZE (1 << SNAPSHOT_PAGE_SHIFT)
+#define PAGE_WORK_RAM 0
+#define PAGE_HIGH_RAM (PAGE_WORK_RAM + (WORK_RAM_SIZE >> SNAPSHOT_PAGE_SHIFT))
+#define PAGE_VRAM (PAGE_HIGH_RAM + 1)
+#define PAGE_OAM (PAGE_VRAM + (VRAM_SIZE >> SNAPSHOT_PAGE_SHIFT))
+#define PAGE_EXTERNAL_RAM (PAGE_OAM + 1)
+#define SNAPSHOT_PAGES (PAGE_EXTERNAL_RAM + (MAX_EXTERNAL_RAM_SIZE >> SNAPSHOT_PAGE_SHIFT))
+
+// An in memory copy of the machine. Keeps a full copy of every page, but
+// taking or restoring one only copies the pages written since it was last
+// taken or restored.
+typedef struct
+{
+    uint32_t epoch;
+    StateRegisters registers;
+    uint8_t pages[SNAPSHOT_PAGES][SNAPSHOT_PAGE_SIZE];
+} Snapshot;
+
+// The epoch each page was last written in
+extern uint32_t snapshotEpoch;
+extern uint32_t snapshotPageEpochs[SNAPSHOT_PAGES];
+
+static inline void Snapshot_touch(uint32_t page)
+{
+    snapshotPageEpochs[page] = snapshotEpoch;
+}
+
+void Snapshot_touchAll(void);
+void Snapshot_init(Snapshot *snapshot);
+uint32_t Snapshot_take(Snapshot *snapshot);
+uint32_t Snapshot_restore(Snapshot *snapshot);
+
+#endif
@@ -0,0 +1,399 @@
+#include "state.h"
+
+#include "file.h"
+#include "snapshot.h"
+
+#include "SDL/SDL.h"
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// A state is a header, a table of sections, then each module's state struct
+// and each memory region as it is in memory, at a fixed aligned offset.
+// Nothing is encoded, so a mapped file is read in place and each section is a
+// single copy back into the module. The byte order mark keeps states from
+// being loaded on a host that lays the structs out differently.
+#define STATE_MAGIC "GBSTATE"
+#define BYTE_ORDER_MARK 0x01020304
+#define SECTION_ALIGN 64
+
+#define FOURCC(a, b, c, d) ((uint32_t)(a) | (uint32_t)(b) << 8 | (uint32_t)(c) << 16 | (uint32_t)(d) << 24)
+
+typedef enum
+{
+    SECTION_MACHINE,
+    SECTION_CPU,
+    SECTION_MEMORY,
+    SECTION_GRAPHICS,
+    SECTION_TIMER,
+    SECTION_INPUT,
+    SECTION_CARTRIDGE,
+    SECTION_APU,
+    // then one section per StateRegion
+    SECTION_COUNT = SECTION_APU + 1 + REGION_COUNT
+} Section;
+
+static const uint32_t sectionIds[SECTION_COUNT] = {
+    FOURCC('M', 'C', 'H', 'N'),
+    FOURCC('C', 'P', 'U', ' '),
+    FOURCC('M', 'E', 'M', ' '),
+    FOURCC('G', 'P', 'U', ' '),
+    FOURCC('T', 'I', 'M', 'R'),
+    FOURCC('I', 'N', 'P', 'T'),
+    FOURCC('C', 'A', 'R', 'T'),
+    FOURCC('A', 'P', 'U', ' '),
+    FOURCC('W', 'R', 'A', 'M'),
+    FOURCC('H', 'R', 'A', 'M'),
+    FOURCC('V', 'R', 'A', 'M'),
+    FOURCC('O', 'A', 'M', ' '),
+    FOURCC('X', 'R', 'A', 'M'),
+};
+
+static const uint32_t sectionSizes[SECTION_COUNT] = {
+    sizeof(MachineState),
+    sizeof(CpuState),
+    sizeof(MemoryState),
+    sizeof(GraphicsState),
+    sizeof(TimerState),
+    sizeof(InputState),
+    sizeof(CartridgeState),
+    sizeof(ApuState),
+    WORK_RAM_SIZE,
+    HIGH_RAM_SIZE,
+    VRAM_SIZE,
+    OAM_SIZE,
+    MAX_EXTERNAL_RAM_SIZE,
+};
+
+typedef struct
+{
+    uint32_t id;
+    uint32_t offset;
+    uint32_t size;
+    uint32_t reserved;
+} StateSection;
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t romHash;
+    uint32_t size;
+    uint32_t sectionCount;
+    StateSection sections[SECTION_COUNT];
+} StateHeader;
+
+static char path[4096];
+static StateLoader loader = State_read;
+static uint8_t saveRequested = 0;
+static uint8_t loadRequested = 0;
+
+static uint32_t align(uint32_t offset)
+{
+    return (offset + SECTION_ALIGN - 1) & ~(SECTION_ALIGN - 1);
+}
+
+static uint32_t sectionOffset(Section section)
+{
+    uint32_t offset = align(sizeof(StateHeader));
+    for (Section i = 0; i < section; i++)
+        offset = align(offset + sectionSizes[i]);
+    return offset;
+}
+
+#define REGION_SECTION(region) (SECTION_APU + 1 + (region))
+
+static void saveSection(Section section, void *out)
+{
+    if (section >= REGION_SECTION(0))
+    {
+        StateRegion region = section - REGION_SECTION(0);
+        memcpy(out, State_region(region), State_regionSize(region));
+        return;
+    }
+    switch (section)
+    {
+        case SECTION_MACHINE: Machine_saveState(out); break;
+        case SECTION_CPU: Cpu_saveState(out); break;
+        case SECTION_MEMORY: Memory_saveState(out); break;
+        case SECTION_GRAPHICS: Graphics_saveState(out); break;
+        case SECTION_TIMER: Timer_saveState(out); break;
+        case SECTION_INPUT: Input_saveState(out); break;
+        case SECTION_CARTRIDGE: Cartridge_saveState(out); break;
+        case SECTION_APU: Apu_saveState(out); break;
+        default: break;
+    }
+}
+
+// Values the modules index tables with are checked before any is loaded
+static uint8_t checkSection(Section section, const void *in)
+{
+    switch (section)
+    {
+        case SECTION_GRAPHICS: return Graphics_checkState(in);
+        case SECTION_TIMER: return Timer_checkState(in);
+        case SECTION_CARTRIDGE: return Cartridge_checkState(in);
+        case SECTION_APU: return Apu_checkState(in);
+        default: return 1;
+    }
+}
+
+static void loadSection(Section section, const void *in)
+{
+    if (section >= REGION_SECTION(0))
+    {
+        StateRegion region = section - REGION_SECTION(0);
+        memcpy(State_region(region), in, State_regionSize(region));
+        return;
+    }
+    switch (section)
+    {
+        case SECTION_MACHINE: Machine_loadState(in); break;
+        case SECTION_CPU: Cpu_loadState(in); break;
+        case SECTION_MEMORY: Memory_loadState(in); break;
+        case SECTION_GRAPHICS: Graphics_loadState(in); break;
+        case SECTION_TIMER: Timer_loadState(in); break;
+        case SECTION_INPUT: Input_loadState(in); break;
+        case SECTION_CARTRIDGE: Cartridge_loadState(in); break;
+        case SECTION_APU: Apu_loadState(in); break;
+        default: break;
+    }
+}
+
+// Files kept for a rom sit beside it, with its extension swapped
+void State_path(char *out, uint32_t size, const char *romFile, const char *extension)
+{
+    snprintf(out, size - strlen(extension), "%s", romFile);
+    char *dot = strrchr(out, '.');
+    char *slash = strrchr(out, '/');
+    char *backslash = strrchr(out, '\\');
+    if (!dot || (slash && dot < slash) || (backslash && dot < backslash))
+        dot = out + strlen(out);
+    strcpy(dot, extension);
+}
+
+void State_init(const char *romFile)
+{
+    State_path(path, sizeof(path), romFile, ".state");
+}
+
+uint8_t *State_region(StateRegion region)
+{
+    switch (region)
+    {
+        case REGION_WORK_RAM: return Memory_workRam();
+        case REGION_HIGH_RAM: return Memory_highRam();
+        case REGION_VRAM: return Graphics_vram();
+        case REGION_OAM: return Graphics_oam();
+        case REGION_EXTERNAL_RAM: return Cartridge_externalRam();
+        default: return NULL;
+    }
+}
+
+uint32_t State_regionSize(StateRegion region)
+{
+    return sectionSizes[REGION_SECTION(region)];
+}
+
+void State_saveRegisters(StateRegisters *registers)
+{
+    Machine_saveState(&registers->machine);
+    Cpu_saveState(&registers->cpu);
+    Memory_saveState(&registers->memory);
+    Graphics_saveState(&registers->graphics);
+    Timer_saveState(&registers->timer);
+    Input_saveState(&registers->input);
+    Cartridge_saveState(&registers->cartridge);
+    Apu_saveState(&registers->apu);
+}
+
+// Modules may look at their memory as they load, so the regions go first
+void State_loadRegisters(const StateRegisters *registers)
+{
+    Machine_loadState(&registers->machine);
+    Cpu_loadState(&registers->cpu);
+    Memory_loadState(&registers->memory);
+    Graphics_loadState(&registers->graphics);
+    Timer_loadState(&registers->timer);
+    Input_loadState(&registers->input);
+    Cartridge_loadState(&registers->cartridge);
+    Apu_loadState(&registers->apu);
+}
+
+uint32_t State_size(void)
+{
+    return sectionOffset(SECTION_COUNT);
+}
+
+// Must be called between instructions, Machine_frame does it between frames
+void State_write(uint8_t *image)
+{
+    uint32_t size = State_size();
+    memset(image, 0, size);
+    StateHeader *header = (StateHeader *)image;
+    memcpy(header->magic, STATE_MAGIC, sizeof(header->magic));
+    header->version = STATE_VERSION;
+    header->byteOrder = BYTE_ORDER_MARK;
+    header->romHash = Cartridge_hash();
+    header->size = size;
+    header->sectionCount = SECTION_COUNT;
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        StateSection *section = &header->sections[i];
+        section->id = sectionIds[i];
+        section->offset = sectionOffset(i);
+        section->size = sectionSizes[i];
+        saveSection(i, image + section->offset);
+    }
+}
+
+// Checks everything before touching any module, so a bad state leaves the
+// machine running as it was
+uint8_t State_read(const uint8_t *image, uint32_t size)
+{
+    const StateHeader *header = (const StateHeader *)image;
+    if (size < sizeof(StateHeader) || memcmp(header->magic, STATE_MAGIC, sizeof(header->magic)))
+    {
+        printf("Not a save state\n");
+        return 0;
+    }
+    if (header->byteOrder != BYTE_ORDER_MARK || header->version != STATE_VERSION)
+    {
+        printf("Save state is from another version or host\n");
+        return 0;
+    }
+    if (header->romHash != Cartridge_hash())
+    {
+        printf("Save state is for another rom\n");
+        return 0;
+    }
+    if (header->size != size || header->sectionCount != SECTION_COUNT)
+    {
+        printf("Save state is truncated or malformed\n");
+        return 0;
+    }
+    for (int i = 0; i < SECTION_COUNT; i++)
+    {
+        const StateSection *section = &header->sections[i];
+        if (section->id != sectionIds[i] || section->size != sectionSizes[i] ||
+            section->offset != sectionOffset(i) || !checkSection(i, image + section->offset))
+        {
+            printf("Save state is truncated or malformed\n");
+            return 0;
+        }
+    }
+    // backwards, the regions have to be in place before the modules load
+    for (int i = SECTION_COUNT - 1; i >= 0; i--)
+        loadSection(i, image + header->sections[i].offset);
+    Snapshot_touchAll();
+    return 1;
+}
+
+// Replaces the file whole, a crash or another launch never sees half a state
+uint8_t State_save(const char *file)
+{
+    uint32_t size = State_size();
+    uint8_t *image = malloc(size);
+    if (!image)
+        return 0;
+    State_write(image);
+    uint8_t ok = File_replace(file, image, size);
+    free(image);
+    if (!ok)
+        printf("Failed to write save state %s\n", file);
+    return ok;
+}
+
+// The file is mapped rather than read, the sections are copied straight out
+// of the page cache
+uint8_t State_load(const char *file)
+{
+    uint64_t start = SDL_GetPerformanceCounter();
+    const uint8_t *image = NULL;
+    uint32_t size = 0;
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(file, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    HANDLE mapping = NULL;
+    if (handle != INVALID_HANDLE_VALUE)
+    {
+        size = GetFileSize(handle, NULL);
+        mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping)
+            image = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    int fd = open(file, O_RDONLY);
+    struct stat info;
+    if (fd >= 0 && !fstat(fd, &info) && info.st_size > 0)
+    {
+        size = info.st_size;
+        void *view = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED)
+            image = view;
+    }
+#endif
+    uint8_t ok = 0;
+    if (!image)
+        printf("Failed to open save state %s\n", file);
+    else
+        ok = loader(image, size);
+#ifdef _WIN32
+    if (image)
+        UnmapViewOfFile(image);
+    if (mapping)
+        CloseHandle(mapping);
+    if (handle != INVALID_HANDLE_VALUE)
+        CloseHandle(handle);
+#else
+    if (image)
+        munmap((void *)image, size);
+    if (fd >= 0)
+        close(fd);
+#endif
+    if (ok)
+        printf("loaded state in %.0fus\n", (SDL_GetPerformanceCounter() - start) * 1e6 / SDL_GetPerformanceFrequency());
+    return ok;
+}
+
+void State_setLoader(StateLoader loader_)
+{
+    loader = loader_;
+}
+
+void State_requestSave(void)
+{
+    saveRequested = 1;
+}
+
+void State_requestLoad(void)
+{
+    loadRequested = 1;
+}
+
+// Hotkeys only ask, the state is taken or replaced once the frame finishes
+void State_frame(void)
+{
+    if (saveRequested)
+    {
+        saveRequested = 0;
+        if (State_save(path))
+            printf("saved state to %s\n", path);
+    }
+    if (loadRequested)
+    {
+        loadRequested = 0;
+        State_load(path);
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "apu.h"
+#include "cartridge.h"
+#include "cpu.h"
+#include "graphics.h"
+#include "input.h"
+#include "machine.h"
+#include "memory.h"
+#include "timer.h"
+
+#include <stdint.h>
+
+#define STATE_VERSION 3
+
+// Everything but the memory regions
+typedef struct
+{
+    MachineState machine;
+    CpuState cpu;
+    MemoryState memory;
+    GraphicsState graphics;
+    TimerState timer;
+    InputState input;
+    CartridgeState cartridge;
+    ApuState apu;
+} StateRegisters;
+
+typedef enum
+{
+    REGION_WORK_RAM,
+    REGION_HIGH_RAM,
+    REGION_VRAM,
+    REGION_OAM,
+    REGION_EXTERNAL_RAM,
+    REGION_COUNT
+} StateRegion;
+
+// Takes a mapped file into the machine. State_read unless another format is
+// registered, which passes anything it doesn't know on to State_read.
+typedef uint8_t (*StateLoader)(const uint8_t *file, uint32_t size);
+
+void State_path(char *out, uint32_t size, const char *romFile, const char *extension);
+void State_init(const char *romFile);
+uint8_t *State_region(StateRegion region);
+uint32_t State_regionSize(StateRegion region);
+void State_saveRegisters(StateRegisters *registers);
+void State_loadRegisters(const StateRegisters *registers);
+uint32_t State_size(void);
+void State_write(uint8_t *image);
+uint8_t State_read(const uint8_t *image, uint32_t size);
+uint8_t State_save(const char *path);
+uint8_t State_load(const char *path);
+void State_setLoader(StateLoader loader);
+void State_requestSave(void);
+void State_requestLoad(void);
+void State_frame(void);
+
+#endif
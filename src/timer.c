@@ -18,16 +18,17 @@ static uint8_t inputClockSelect = 0;
 // Timer Interrupt Request
 static uint8_t interruptRequest = 0;
 
-void Timer_step(uint8_t ticks)
+static uint16_t dividerCounter = 0;
+static uint16_t countCounter = 0;
+static const uint16_t clockDivisors[] = {
+    256, 4, 16, 64
+};
+
+void Timer_step(uint16_t ticks)
 {
-    static uint8_t dividerCounter = 0;
-    static uint16_t countCounter = 0;
-    static uint16_t clockDivisors[] = {
-        256, 4, 16, 64
-    };
     ticks /= 4; // t clock to m clock
     dividerCounter += ticks;
-    if (dividerCounter >= 64)
+    while (dividerCounter >= 64)
     {
         divider++;
         dividerCounter -= 64;
@@ -101,9 +102,48 @@ void Timer_wb(uint16_t addr, uint8_t val)
     }
 }
 
+uint16_t Timer_cyclesUntilEvent(void)
+{
+    if (!timerEnable)
+        return 0xFFFC;
+    uint32_t mCycles = (256 - counter) * clockDivisors[inputClockSelect] - countCounter;
+    if (mCycles > 0xFFFC / 4)
+        return 0xFFFC;
+    return mCycles * 4;
+}
+
 uint8_t Timer_interrupt(void)
 {
     uint8_t interrupt = interruptRequest;
     interruptRequest = 0;
     return interrupt;
 }
+
+void Timer_saveState(TimerState *state)
+{
+    state->divider = divider;
+    state->counter = counter;
+    state->modulo = modulo;
+    state->timerEnable = timerEnable;
+    state->inputClockSelect = inputClockSelect;
+    state->interruptRequest = interruptRequest;
+    state->dividerCounter = dividerCounter;
+    state->countCounter = countCounter;
+}
+
+uint8_t Timer_checkState(const TimerState *state)
+{
+    return state->inputClockSelect < sizeof(clockDivisors) / sizeof(clockDivisors[0]);
+}
+
+void Timer_loadState(const TimerState *state)
+{
+    divider = state->divider;
+    counter = state->counter;
+    modulo = state->modulo;
+    timerEnable = state->timerEnable;
+    inputClockSelect = state->inputClockSelect;
+    interruptRequest = state->interruptRequest;
+    dividerCounter = state->dividerCounter;
+    countCounter = state->countCounter;
+}
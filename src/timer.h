@@ -3,9 +3,25 @@
 
 #include <stdint.h>
 
-void Timer_step(uint8_t ticks);
+typedef struct
+{
+    uint8_t divider;
+    uint8_t counter;
+    uint8_t modulo;
+    uint8_t timerEnable;
+    uint8_t inputClockSelect;
+    uint8_t interruptRequest;
+    uint16_t dividerCounter;
+    uint16_t countCounter;
+} TimerState;
+
+void Timer_step(uint16_t ticks);
 uint8_t Timer_rb(uint16_t addr);
 void Timer_wb(uint16_t addr, uint8_t val);
+uint16_t Timer_cyclesUntilEvent(void);
 uint8_t Timer_interrupt(void);
+void Timer_saveState(TimerState *state);
+uint8_t Timer_checkState(const TimerState *state);
+void Timer_loadState(const TimerState *state);
 
 #endif
@@ -0,0 +1,163 @@
+#include "wav.h"
+
+#include "apu.h"
+#include "file.h"
+
+#include "SDL/SDL.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Each apu flush is queued whole for a writer thread. Unlike the video
+// recorder nothing is ever dropped, the capture has to be exact, so a full
+// queue holds the emulation until the disk catches up.
+#define QUEUE_CHUNKS 64
+#define CHUNK_FRAMES 4096
+
+#define HEADER_SIZE 44
+// The RIFF sizes are 32 bits, about 6 hours at 48kHz
+#define MAX_DATA_BYTES (UINT32_MAX - HEADER_SIZE)
+
+typedef struct
+{
+    uint32_t frames;
+    int16_t samples[CHUNK_FRAMES * 2];
+} Chunk;
+
+static Chunk queue[QUEUE_CHUNKS];
+static SDL_atomic_t queueHead = {0};
+static SDL_atomic_t queueTail = {0};
+static SDL_sem *pending = NULL;
+static SDL_sem *freed = NULL;
+static SDL_atomic_t stopping = {0};
+static SDL_Thread *writer = NULL;
+
+static uint8_t capturing = 0;
+static FILE *file = NULL;
+static uint32_t rate = 0;
+
+// Writer side
+static uint8_t bytes[CHUNK_FRAMES * 4];
+static uint64_t dataBytes = 0;
+static uint8_t full = 0;
+static uint64_t hash = 1469598103934665603ULL;
+
+// Sizes are left at zero until the capture stops and they're known
+static void writeHeader(uint32_t size)
+{
+    uint8_t header[HEADER_SIZE];
+    memcpy(header, "RIFF", 4);
+    File_put32(header + 4, size + HEADER_SIZE - 8);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    File_put32(header + 16, 16);
+    File_put16(header + 20, 1);
+    File_put16(header + 22, 2);
+    File_put32(header + 24, rate);
+    File_put32(header + 28, rate * 4);
+    File_put16(header + 32, 4);
+    File_put16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    File_put32(header + 40, size);
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, 1, HEADER_SIZE, file);
+}
+
+// Past what the header can describe the rest is dropped, with a warning,
+// rather than the sizes wrapping into a corrupt file
+static void writeChunk(const Chunk *chunk)
+{
+    uint32_t count = chunk->frames * 2;
+    if (dataBytes + count * 2 > MAX_DATA_BYTES)
+    {
+        if (!full)
+            printf("wav capture reached the 4GB limit of the format, the rest is dropped\n");
+        full = 1;
+        return;
+    }
+    for (uint32_t i = 0; i < count; i++)
+        File_put16(&bytes[i * 2], chunk->samples[i]);
+    fwrite(bytes, 1, count * 2, file);
+    for (uint32_t i = 0; i < count * 2; i++)
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    dataBytes += count * 2;
+}
+
+static int writeChunks(void *data)
+{
+    (void)data;
+    while (1)
+    {
+        SDL_SemWait(pending);
+        uint8_t stop = SDL_AtomicGet(&stopping);
+        uint32_t tail = SDL_AtomicGet(&queueTail);
+        uint32_t head = SDL_AtomicGet(&queueHead);
+        SDL_MemoryBarrierAcquire();
+        for (; tail != head; tail++)
+        {
+            writeChunk(&queue[tail % QUEUE_CHUNKS]);
+            SDL_AtomicSet(&queueTail, tail + 1);
+            SDL_SemPost(freed);
+        }
+        if (stop)
+            return 0;
+    }
+}
+
+static void capture(const int16_t *samples, uint32_t frames)
+{
+    while (frames)
+    {
+        uint32_t head = SDL_AtomicGet(&queueHead);
+        while (head - (uint32_t)SDL_AtomicGet(&queueTail) == QUEUE_CHUNKS)
+            SDL_SemWaitTimeout(freed, 10);
+        Chunk *chunk = &queue[head % QUEUE_CHUNKS];
+        chunk->frames = frames < CHUNK_FRAMES ? frames : CHUNK_FRAMES;
+        memcpy(chunk->samples, samples, chunk->frames * 4);
+        samples += chunk->frames * 2;
+        frames -= chunk->frames;
+        SDL_MemoryBarrierRelease();
+        SDL_AtomicSet(&queueHead, head + 1);
+        SDL_SemPost(pending);
+    }
+}
+
+// Captures everything the apu produces to a 16 bit stereo wav, in emulated
+// time and whatever the speed or audio device
+void Wav_start(const char *path, uint32_t sampleRate)
+{
+    file = fopen(path, "wb");
+    if (!file)
+    {
+        printf("Failed to open wav file %s\n", path);
+        exit(1);
+    }
+    rate = sampleRate;
+    writeHeader(0);
+
+    pending = SDL_CreateSemaphore(0);
+    freed = SDL_CreateSemaphore(0);
+    writer = pending && freed ? SDL_CreateThread(writeChunks, "wav", NULL) : NULL;
+    if (!writer)
+    {
+        printf("Failed to start wav writer thread\n");
+        exit(1);
+    }
+    capturing = 1;
+    Apu_addSink(capture);
+    atexit(Wav_stop);
+}
+
+void Wav_stop(void)
+{
+    if (!capturing)
+        return;
+    capturing = 0;
+    SDL_AtomicSet(&stopping, 1);
+    SDL_SemPost(pending);
+    SDL_WaitThread(writer, NULL);
+    writeHeader(dataBytes);
+    fclose(file);
+    printf("captured %" PRIu64 " audio frames, hash %016" PRIx64 "\n", dataBytes / 4, hash);
+}
@@ -0,0 +1,9 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stdint.h>
+
+void Wav_start(const char *path, uint32_t sampleRate);
+void Wav_stop(void);
+
+#endif